@@ -17,6 +17,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,9 +30,14 @@
 #include <fuse.h>
 
 #include "a1fs.h"
+#include "a1fs_ll.h"
+#include "alloc.h"
+#include "bdev.h"
+#include "dir.h"
+#include "file.h"
+#include "flush.h"
 #include "fs_ctx.h"
 #include "options.h"
-#include "map.h"
 
 //NOTE: All path arguments are absolute paths within the a1fs file system and
 // start with a '/' that corresponds to the a1fs root directory.
@@ -45,6 +51,38 @@
 // FUSE callbacks as "/dir".
 
 
+/**
+ * Pass the access hints given as mount options on to the kernel.
+ *
+ * The hints only affect performance, so failures (e.g. huge pages not being
+ * supported for the image file) are ignored. Without a mapping (-o
+ * backend=pread), the prefetch and access hints go to the kernel page cache of
+ * the image file instead, and the huge page hint does not apply.
+ */
+static void advise_image(fs_ctx *fs, a1fs_opts *opts)
+{
+	bdev *dev = &fs->dev;
+	// The metadata comes first in the image, up to the first data block (but for
+	// the inode table slices of block groups, which are spread over the image)
+	size_t meta_size = (size_t)fs->sb->first_data_block * A1FS_BLOCK_SIZE;
+
+	if (dev->image == NULL) {
+		if (opts->prefetch_meta) posix_fadvise(dev->fd, 0, meta_size, POSIX_FADV_WILLNEED);
+		if (opts->access_advice != MADV_NORMAL) {
+			int advice = (opts->access_advice == MADV_RANDOM) ? POSIX_FADV_RANDOM
+			                                                  : POSIX_FADV_SEQUENTIAL;
+			posix_fadvise(dev->fd, meta_size, dev->size - meta_size, advice);
+		}
+		return;
+	}
+
+	if (opts->hugepage) madvise(dev->image, dev->size, MADV_HUGEPAGE);
+	if (opts->prefetch_meta) madvise(dev->image, meta_size, MADV_WILLNEED);
+	if (opts->access_advice != MADV_NORMAL) {
+		madvise((char *)dev->image + meta_size, dev->size - meta_size, opts->access_advice);
+	}
+}
+
 /**
  * Initialize the file system.
  *
@@ -61,11 +99,44 @@ static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
 	// Nothing to initialize if only printing help
 	if (opts->help) return true;
 
-	size_t size;
-	void *image = map_file(opts->img_path, A1FS_BLOCK_SIZE, &size);
-	if (!image) return false;
+	bdev dev;
+	if (opts->backend_type == A1FS_BACKEND_PREAD) {
+		size_t cache_blocks = (size_t)opts->cache_mb * (1 << 20) / A1FS_BLOCK_SIZE;
+		if (!bdev_open_pread(&dev, opts->img_path, cache_blocks)) return false;
+	} else {
+		if (!bdev_open_mmap(&dev, opts->img_path, opts->populate ? MAP_POPULATE : 0)) {
+			return false;
+		}
+	}
+
+	if (!fs_ctx_init(fs, &dev)) return false;
+	fs->sync_mode = opts->sync_mode;
+	fs->sync_interval_ms = opts->sync_interval_ms;
+	fs->multithreaded = opts->multithreaded;
+	advise_image(fs, opts);
+	return true;
+}
 
-	return fs_ctx_init(fs, image, size);
+/**
+ * Start the background work of the file system.
+ *
+ * Called by FUSE once the file system is mounted, after fuse_main() has
+ * daemonized, so that the threads started here survive the fork. Starts the
+ * flusher thread of -o sync=periodic; if it cannot be started, falls back to
+ * -o sync=always, which writes changes back even sooner.
+ *
+ * @param conn  unused.
+ * @return      the file system context, which FUSE passes to all callbacks.
+ */
+static void *a1fs_start(struct fuse_conn_info *conn)
+{
+	(void)conn;// unused
+	fs_ctx *fs = (fs_ctx*)fuse_get_context()->private_data;
+	if (!flusher_start(fs)) {
+		fprintf(stderr, "Failed to start the flusher thread; using sync=always\n");
+		fs->sync_mode = A1FS_SYNC_ALWAYS;
+	}
+	return fs;
 }
 
 /**
@@ -77,16 +148,24 @@ static bool a1fs_init(fs_ctx *fs, a1fs_opts *opts)
 static void a1fs_destroy(void *ctx)
 {
 	fs_ctx *fs = (fs_ctx*)ctx;
-	if (fs->image) {
-		munmap(fs->image, fs->size);
+	if (fs->dev.ops) {
+		flusher_stop(fs);
 		fs_ctx_destroy(fs);
 	}
 }
 
-/** Get file system context. */
+/**
+ * Get file system context.
+ *
+ * Must be called at the start of each callback, before any blocks of the image
+ * are used: gives back the blocks the calling thread used in its previous
+ * operation (see bdev_release()).
+ */
 static fs_ctx *get_fs(void)
 {
-	return (fs_ctx*)fuse_get_context()->private_data;
+	fs_ctx *fs = (fs_ctx*)fuse_get_context()->private_data;
+	bdev_release(&fs->dev);
+	return fs;
 }
 
 
@@ -116,7 +195,7 @@ static int a1fs_statfs(const char *path, struct statvfs *st)
 	memset(st, 0, sizeof(*st));
 	st->f_bsize   = A1FS_BLOCK_SIZE;  			/* Filesystem block size */
 	st->f_frsize  = A1FS_BLOCK_SIZE;  			/* Fragment size */
-	st->f_blocks = fs->size / A1FS_BLOCK_SIZE;  /* Size of fs in f_frsize units */
+	st->f_blocks = fs->dev.size / A1FS_BLOCK_SIZE;  /* Size of fs in f_frsize units */
 	st->f_bfree = fs->sb->free_blocks_count;    /* Number of free blocks */
 	st->f_bavail = fs->sb->free_blocks_count;   /* Number of free blocks for
 													unprivileged users */
@@ -131,62 +210,7 @@ static int a1fs_statfs(const char *path, struct statvfs *st)
 
 	return 0;
 }
-/**
- * return array of extents belonging to inode
-**/
-a1fs_extent *get_extents(a1fs_inode *inode, fs_ctx *fs){
-	a1fs_extent *extents = fs->image + (fs->sb->first_data_block + inode->extents) * A1FS_BLOCK_SIZE;
-	return extents;
-}
 
-void *get_block(int block_number, fs_ctx *fs){
-	return fs->image + (fs->sb->first_data_block + block_number) * A1FS_BLOCK_SIZE;
-}
-
-a1fs_inode *get_inode(int inode_number, fs_ctx *fs){
-	return fs->image + fs->sb->inode_table * A1FS_BLOCK_SIZE + inode_number * sizeof(a1fs_inode);
-}
-
-a1fs_dentry *get_entry(a1fs_inode *directory, char *entry_name, fs_ctx *fs){
-	a1fs_dentry *entry;
-	int entries_in_block;
-
-	// Loop through the extents to look for the entry
-	a1fs_extent *extents = get_extents(directory, fs);
-	for(int i = 0; i < directory->num_extents; i++){
-		a1fs_extent extent = extents[i];
-		
-		for(unsigned int j = extent.start; j < extent.start + extent.count; j++){
-			a1fs_dentry *curr_block_entries = get_block(j, fs);
-
-	        if(i == directory->num_extents - 1 && j == extent.start + extent.count - 1){
-				entries_in_block = directory->size % A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
-			}else{
-				entries_in_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dentry);
-			}
-
-			for(int k = 0; k < entries_in_block; k++){
-				if (strcmp(curr_block_entries[k].name, entry_name) == 0){
-					entry = &curr_block_entries[k];
-					return entry;
-				}
-			}
-		
-		}	
-	}
-	return NULL;
-}
-
-/**
- * populate ino with the inode number associated with entry_name in directory
- * return 0 on success, else return -errno
-**/
-int get_entry_ino(a1fs_inode *directory, char *entry_name, int *ino, fs_ctx *fs){
-    a1fs_dentry *entry = get_entry(directory, entry_name, fs);
-	if(entry == NULL) return -ENOENT;
-	*ino = entry->ino;
-	return 0;
-}
 
 /**
  * populate the a1fs_inode result
@@ -201,25 +225,42 @@ int path_lookup(const char *path, a1fs_inode **result, fs_ctx *fs){
 	char pathstring[A1FS_PATH_MAX];
     strncpy(pathstring, path, A1FS_PATH_MAX);
     pathstring[A1FS_PATH_MAX - 1] = '\0'; // null terminate
-	int inode_number = 0; //start at root inode
+	a1fs_ino_t inode_number = 0; //start at root inode
 	int error;
 
-	//array of inodes in inode table
-	a1fs_inode *itable = (a1fs_inode *)(fs->image + (fs->sb->inode_table) * A1FS_BLOCK_SIZE);
-
-	char *component = strtok(pathstring, "/");
+	char *saveptr;
+	char *component = strtok_r(pathstring, "/", &saveptr);
 	while(component != NULL){
-        a1fs_inode *directory = &(itable[inode_number]);
+        a1fs_inode *directory = get_inode(inode_number, fs);
 		if((directory->mode & S_IFDIR) != S_IFDIR) return -ENOTDIR;
-        if((error = get_entry_ino(directory, component, &inode_number, fs)) != 0) return error;
-        component = strtok(NULL, "/");
+		//hold the directory lock only while scanning its entries
+		inode_rdlock(fs, inode_number);
+		error = get_entry_ino(directory, component, &inode_number, fs);
+		inode_unlock(fs, directory->inode_number);
+        if(error != 0) return error;
+        component = strtok_r(NULL, "/", &saveptr);
     }
-	*result = &itable[inode_number];
+	*result = get_inode(inode_number, fs);
 	return 0;
 }
 
-unsigned int round_up_divide(unsigned int x, unsigned int y){
-	return x / y + ((x % y) != 0);
+/**
+ * return the handle of the open file fi (see a1fs_open()), NULL if there is none
+**/
+static a1fs_handle *get_handle(struct fuse_file_info *fi){
+	return (fi != NULL) ? (a1fs_handle *)(uintptr_t)fi->fh : NULL;
+}
+
+/**
+ * return the inode of the file at path, found through the handle of the open file fi
+ * without walking the path if it has one
+**/
+static a1fs_inode *file_inode(const char *path, struct fuse_file_info *fi, fs_ctx *fs){
+	a1fs_handle *h = get_handle(fi);
+	if(h != NULL) return get_inode(h->ino, fs);
+	a1fs_inode *inode;
+	path_lookup(path, &inode, fs);
+	return inode;
 }
 
 /**
@@ -254,59 +295,34 @@ static int a1fs_getattr(const char *path, struct stat *st)
 	a1fs_inode *inode;
 	int error = path_lookup(path, &inode, fs);
 	if(error != 0) return error;
-	
+
 	//NOTE: all the fields set below are required and must be set according
 	// to the information stored in the corresponding inode
-	st->st_ino = inode->inode_number;
-	st->st_mode = inode->mode;
-	st->st_nlink = inode->links;
-	st->st_size = inode->size;
-	st->st_blocks = round_up_divide(inode->size, A1FS_BLOCK_SIZE) * (A1FS_BLOCK_SIZE / 512);
-	st->st_mtim = inode->mtime;
-	
+	stat_inode(inode, st, fs);
 	return 0;
 }
 
 /**
- * return array of directory entries contained in directory
- * NOTE: array pointer must be freed when using this function
- * 
-**/
-a1fs_dentry *get_entries_copy(a1fs_inode *directory, fs_ctx *fs){
-
-	a1fs_dentry *entries;
-	if((entries = malloc(directory->size)) == NULL) return NULL;
-
-	//used to keep track of where we are copying data to in memcpy
-	void *dest = (void *)entries;
-
-	//pointer to array of extents for directory
-	a1fs_extent *extents = fs->image + (fs->sb->first_data_block + directory->extents) * A1FS_BLOCK_SIZE;
-
-	//loop through extents
-	for(int i = 0; i < directory->num_extents; i++){
-		a1fs_extent extent = extents[i];
-		
-		//loop through data blocks in the current extent
-		for(unsigned int j = extent.start; j < extent.start + extent.count; j++){
-			//point to start of current data block
-			const void *src = fs->image + (fs->sb->first_data_block + j) * A1FS_BLOCK_SIZE;
-			
-			//if last data block, only copy whats left in directory
-			if(i == (directory->num_extents - 1) && j == (extent.start + extent.count - 1)){
-				memcpy(dest, src, directory->size % A1FS_BLOCK_SIZE);
-			} // else copy whole block
-			else{
-				memcpy(dest, src, A1FS_BLOCK_SIZE);
-			}
-			//move dest so we dont overwrite whats already copied into entries 
-			dest += A1FS_BLOCK_SIZE;
+ * Get attributes of an open file.
+ *
+ * Implements the fstat() system call; see a1fs_getattr(). The file is found
+ * through its handle instead of its path.
+ *
+ * @param path  path to the file.
+ * @param st    pointer to the struct stat that receives the result.
+ * @param fi    open file info; see a1fs_open().
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_fgetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
 
-		}
-	}
-	return entries;
+	memset(st, 0, sizeof(*st));
+	stat_inode(file_inode(path, fi, fs), st, fs);
+	return 0;
 }
 
+
 /**
  * Read a directory.
  *
@@ -324,244 +340,46 @@ a1fs_dentry *get_entries_copy(a1fs_inode *directory, fs_ctx *fs){
  * @param filler  function that needs to be called for each directory entry.
  *                Pass 0 as offset (4th argument). 3rd argument can be NULL.
  * @param offset  unused.
- * @param fi      unused.
+ * @param fi      open directory info; see a1fs_opendir().
  * @return        0 on success; -errno on error.
  */
 static int a1fs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
                         off_t offset, struct fuse_file_info *fi)
 {
 	(void)offset;// unused
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
 	//TODO: lookup the directory inode for given path and iterate through its
 	// directory entries
 	
-	a1fs_inode *directory;
-	path_lookup(path, &directory, fs);
-	a1fs_dentry *entries;
-	if((entries = get_entries_copy(directory, fs)) == NULL) return -ENOMEM;
-
-	int num_entries = directory->size / sizeof(a1fs_dentry);
-
-	if(filler(buf, "." , NULL, 0) + filler(buf, "..", NULL, 0) > 0) return -ENOMEM;
-	
-
-	for(int i = 0; i < num_entries; i++){
-		a1fs_dentry entry = entries[i];
-		if(filler(buf, entry.name, NULL, 0) == 1) return -ENOMEM;
+	a1fs_inode *directory = file_inode(path, fi, fs);
+
+	//copy the entries under the lock so that filler() runs without holding it
+	inode_rdlock(fs, directory->inode_number);
+	uint32_t num_entries;
+	char *names = get_entry_names(directory, &num_entries, fs);
+	inode_unlock(fs, directory->inode_number);
+	if(names == NULL) return -ENOMEM;
+
+	if(filler(buf, "." , NULL, 0) + filler(buf, "..", NULL, 0) > 0){
+		free(names);
+		return -ENOMEM;
 	}
-	free(entries);
-		
-	return 0;
 
-}
-
-/**
- * search the given bitmap for an extent of length length
- * 
- * populate the extent struct given with the first extent found of length length, or,
- * if none exist, the extent of longest length
- * 
- * @param bitmap    pointer to the start of the bitmap
- * @param num_bits  the number of bits belonging ot the bitmap
- * @param length    the length of the extent we are searching for
- * @param extent    extent struct to populate 
- * @return          0 on success, -ENOSPC on error e.g no space
- */
-int search_bitmap(unsigned char *bitmap, int num_bits, unsigned int length, a1fs_extent *extent){
-	int num_bytes = num_bits / 8;
-	int bits_iterated= 0;
-	unsigned int start = 0;
-	unsigned int count = 0;
-	int i = 0;
-	int remaining_bits = 0;
-	extent->count = 0;
-
-	while (i < num_bytes + 1){
-		// the 8 bits that we are iterating
-		unsigned char current_byte = bitmap[i];
-
-		// number of bits of the current byte that needs to be counted
-		if ((num_bits - bits_iterated) >= 8){
-			remaining_bits = 8;
-		} else {
-			remaining_bits = num_bits - bits_iterated;
-		}
-		
-		// iterate through each bit to see if an inode is free
-		for (int n = 0; n < remaining_bits; n++){
-			if (!(current_byte & (1 << (7 - n)))){
-				if(count == 0){
-					start = bits_iterated + n;
-				}
-				count++;
-
-				if(count == length){
-					extent->start = start;
-					extent->count = count;
-					return 0;
-				}
-			}else{
-				if(count > extent->count){
-					extent->start = start;
-					extent->count = count;
-				} 
-				count = 0;
-			}
+	char *name = names;
+	for(uint32_t i = 0; i < num_entries; i++){
+		if(filler(buf, name, NULL, 0) == 1){
+			free(names);
+			return -ENOMEM;
 		}
-		// increase the counter for number of bits iterated
-		bits_iterated += remaining_bits;
-		i++;
+		name += strlen(name) + 1;
 	}
-	if(extent->count == 0) return -ENOSPC;
-	return 0;
-}
-
-/**
- * switch bit bit_number to a 1 in bitmap
-**/
-void allocate_bit(unsigned char map, int bit_number, fs_ctx *fs){
-	int map_start;
-	if(map == 'd'){
-		map_start = fs->sb->data_bitmap;
-		fs->sb->free_blocks_count--;
-	}else{
-		map_start = fs->sb->inode_bitmap;
-		fs->sb->free_inodes_count--;
-	}
-	unsigned char *bitmap = fs->image + map_start * A1FS_BLOCK_SIZE;
-	int byte_number = bit_number / 8;
-	int bit_number_in_byte = bit_number % 8;
-	unsigned char bitmask = (1 << (7 - bit_number_in_byte));
-	bitmap[byte_number] = bitmap[byte_number] | bitmask;
-}
-
-/**
- * switch all bits from extent start to extent start + extent count to 1
- * NOTE: assumed we are allocating to the data bitmap
-**/
-void allocate_extent(a1fs_extent *extent, fs_ctx *fs){
-	for(unsigned int i = extent->start; i < extent->start + extent->count; i++){
-		allocate_bit('d', i, fs);
-		memset(get_block(i, fs), 0, A1FS_BLOCK_SIZE);
-	}
-}
-
-/**
- * Traverses the inode_bitmap and allocate the first available inode
- * return 0 on success, return -1 on error
- * 
- * @param fs 			file system context
- * @param inode_number 	index of free inode found, -1 if not found
- * @return int 0 on success, -1 on error
- */
-int allocate_inode(int *inode_number, fs_ctx *fs){
-    unsigned char *inode_bitmap = fs->image + (fs->sb->inode_bitmap) * A1FS_BLOCK_SIZE;
-	a1fs_extent extent;
-
-	if(search_bitmap(inode_bitmap, fs->sb->inodes_count, 1, &extent) != 0) return -ENOSPC;
-
-	*inode_number = extent.start;
-
-	allocate_bit('i', *inode_number, fs);
-
-	return 0;
-
-}
-
-/**
- * Allocate num_blocks data blocks to inode pointed to by inode
- * 
- * @param inode      pointer to inode to allocate space for
- * @param num_bytes  number of bytes to allocate
- * @param fs         file system context
- * @return           0 on success, -ENOSPC if not enough space available
-**/
-int allocate_blocks(a1fs_inode *inode, int num_blocks, fs_ctx *fs){
-	if(fs->sb->free_blocks_count == 0) return -ENOSPC;
-	if(num_blocks > (int)fs->sb->free_blocks_count || inode->num_extents == A1FS_BLOCK_SIZE / sizeof(a1fs_extent)){
-		return -ENOSPC;
-	}
-	int num_bits_dmap = fs->sb->blocks_count - fs->sb->resv_blocks_count;
-	unsigned char *data_bitmap = fs->image + fs->sb->data_bitmap * A1FS_BLOCK_SIZE;
-
-	a1fs_extent extent;
-	
-    //initialize extent map if file empty
-	if(inode->extents == -1){
-		search_bitmap(data_bitmap, num_bits_dmap, 1, &extent);
-		allocate_bit('d', extent.start, fs);
-		inode->extents = extent.start;
-	}
-	
-	a1fs_extent *extents = get_extents(inode, fs);
-
-	while(num_blocks > 0){
-		search_bitmap(data_bitmap, num_bits_dmap, num_blocks, &extent);
-		allocate_extent(&extent, fs);
-		extents[inode->num_extents] = extent;
-		inode->num_extents++;
-		num_blocks -= extent.count;
-	}
-
+	free(names);
+		
 	return 0;
-}
-
-/**
- * return the block number of the last data block owned by the file represented by inode
- * 
- * @param inode  pointer to inode struct of the file
- * @param fs     file system context
-**/
-int get_last_block(a1fs_inode *inode, fs_ctx *fs){
-	a1fs_extent *extents = fs->image + (fs->sb->first_data_block + inode->extents) * A1FS_BLOCK_SIZE;
-	a1fs_extent last_extent = extents[inode->num_extents - 1];
-	int last_block = last_extent.start + last_extent.count - 1;
-	return last_block;
-}
 
-/**
- * return pointer to the very front of the file represented by inode.
- * Front in this case points to the start of the first byte which is not part of the file
- * but that exists in the last data block owned by this file
- * 
- * @param inode  pointer to inode struct to find the front of
- * @param fs     file system context
-**/
-void *get_front(a1fs_inode *inode, fs_ctx *fs){
-	int last_block = get_last_block(inode, fs);
-	void *front = fs->image + (fs->sb->first_data_block + last_block) * A1FS_BLOCK_SIZE 
-						+ inode->size % A1FS_BLOCK_SIZE;
-	return front;
 }
 
-/**
- * add new directory entry to the directory represented by directory
- * with name set to filename and ino set to inode_number
- * 
- * @param directory     pointer to inode representing the directory
- * @param filename      name of the entry
- * @param inode_number  inode number of the inode pointed to by the new entry
- * @param fs            file system context
-**/
-int add_dentry(a1fs_inode *directory, char *filename, a1fs_inode *inode, fs_ctx *fs){
-	//if directory is full, allocate new block for entry
-
-	int bytes_remainder = directory->size % A1FS_BLOCK_SIZE;
-	if(bytes_remainder == 0){
-		if(allocate_blocks(directory, 1, fs) != 0) return -ENOSPC;
-	}
-	//otherwise add entry to last data block
-
-	a1fs_dentry *new_entry = (a1fs_dentry *)(get_front(directory, fs));
-	new_entry->ino = inode->inode_number;
-	strncpy(new_entry->name, filename, A1FS_NAME_MAX);
-	directory->size += sizeof(a1fs_dentry);
-	if((inode->mode & S_IFDIR) == S_IFDIR) directory->links++;
-	return 0;
-
-}
 
 /**
  * fill filename with the file name specified at the end of path 
@@ -598,23 +416,6 @@ static int a1fs_mkdir(const char *path, mode_t mode)
 	fs_ctx *fs = get_fs();
 
 	//TODO: create a directory at given path with given mode
-	int inode_number;
-	if ((allocate_inode(&inode_number, fs)) != 0){
-		return -ENOSPC;
-	}
-	
-	// Create the directory only if there exists an available slot
-	a1fs_inode *itable = fs->image + fs->sb->inode_table * A1FS_BLOCK_SIZE;
-	a1fs_inode *directory = &itable[inode_number];
-	directory->inode_number = inode_number;
-	directory->mode = mode;
-	directory->links = 2;	// ".." and "."
-	directory->size = 0;
-	clock_gettime(CLOCK_REALTIME, &(directory->mtime));
-	directory->num_extents = 0;
-	directory->extents = -1;
-
-
 	char filename[A1FS_NAME_MAX]; //have to copy like this to avoid bugs
 	char parent_path[A1FS_PATH_MAX];
 	split_path(path, parent_path, filename);
@@ -622,91 +423,11 @@ static int a1fs_mkdir(const char *path, mode_t mode)
 	a1fs_inode *parent_dir;
 	path_lookup((const char *)(parent_path), &parent_dir, fs);
 
-	add_dentry(parent_dir, filename, directory, fs);
-
-	return 0;
-}
-
-
-/**
- * switch bit bit_number to a 0 in bitmap
-**/
-void deallocate_bit(unsigned char map, int bit_number, fs_ctx *fs){
-	int map_start;
-	if(map == 'd'){
-		map_start = fs->sb->data_bitmap;
-		fs->sb->free_blocks_count++;
-	}else{
-		map_start = fs->sb->inode_bitmap;
-		fs->sb->free_inodes_count++;
-	}
-	unsigned char *bitmap = fs->image + map_start * A1FS_BLOCK_SIZE; 
-	int byte_number = bit_number / 8;
-	int bit_number_in_byte = bit_number % 8;
-	unsigned char bitmask = ~(1 << (7 - bit_number_in_byte));
-	bitmap[byte_number] = bitmap[byte_number] & bitmask;	
-}
-
-/**
- * deallocate all data blocks pointed to by the inodes extents
- * change inode bitmap at index of the inode's number to 0
- * 
- * @param inode  the inode to deallocate
- * @param fs     file system context
-**/
-void deallocate_inode(a1fs_inode *inode, fs_ctx *fs){
-	a1fs_extent *extents = get_extents(inode, fs);
-	//loop through all data blocks in all extents and deallocate the block
-	for(int i = 0; i < inode->num_extents; i++){
-		a1fs_extent extent = extents[i];
-		for(unsigned int j = extent.start; j < extent.start + extent.count; j++){
-				deallocate_bit('d', j, fs);
-		}
-	}
-
-	deallocate_bit('i', inode->inode_number, fs);
-
-}
-
-
-
-void deallocate_blocks(a1fs_inode *inode, int num_blocks, fs_ctx *fs){
-	a1fs_extent *extents = get_extents(inode, fs);
-	while(num_blocks > 0){
-		a1fs_extent *last_extent = &extents[inode->num_extents - 1];
-		if((int)last_extent->count > num_blocks){
-
-			int last_block = last_extent->start + last_extent->count - 1;
-			for(int i = 0; i < num_blocks; i++){
-				deallocate_bit('d', last_block - i, fs);
-			}
-			last_extent->count -= num_blocks;
-			num_blocks = 0;
-			
-		}else if((int)last_extent->count < num_blocks){
-			for(unsigned int i = last_extent->start; i < last_extent->start + last_extent->count; i++){
-				deallocate_bit('d', i, fs);
-			}
-			num_blocks -= last_extent->count;
-			inode->num_extents -= 1;
-			
-		}else {
-			inode->num_extents -= 1;
-			num_blocks = 0;
-		}
-	}
+	a1fs_inode *directory;
+	return create_node(parent_dir, filename, mode, &directory, fs);
 }
 
 
-void remove_entry(a1fs_inode *directory, a1fs_dentry *entry, fs_ctx *fs){
-	a1fs_dentry *last_entry = get_front(directory, fs) - sizeof(a1fs_dentry);
-    memcpy(entry, last_entry, sizeof(a1fs_dentry));
-	directory->size -= sizeof(a1fs_dentry);
-
-	if(directory->size % A1FS_BLOCK_SIZE == 0){
-		deallocate_blocks(directory, 1, fs);
-	}
-}
 /**
  * 
  * Remove a directory.
@@ -717,6 +438,7 @@ void remove_entry(a1fs_inode *directory, a1fs_dentry *entry, fs_ctx *fs){
  *   "path" exists and is a directory.
  *
  * Errors:
+ *   ENOENT     the directory was removed meanwhile by another thread.
  *   ENOTEMPTY  the directory is not empty.
  *
  * @param path  path to the directory to remove.
@@ -735,14 +457,30 @@ static int a1fs_rmdir(const char *path)
 	a1fs_inode *parent_dir;
 	path_lookup((const char *)parent_path, &parent_dir, fs);
 
-	a1fs_dentry *dir_entry = get_entry(parent_dir, filename, fs);
-	a1fs_inode *dir_inode = get_inode(dir_entry->ino, fs);
-	if(dir_inode->size > 0) return -ENOTEMPTY;
+	//lock order is always parent before child
+	inode_wrlock(fs, parent_dir->inode_number);
+	//the entry may have been removed or renamed since FUSE looked it up
+	a1fs_ino_t dir_ino;
+	int error = get_entry_ino(parent_dir, filename, &dir_ino, fs);
+	if(error != 0){
+		inode_unlock(fs, parent_dir->inode_number);
+		return error;
+	}
+	a1fs_inode *dir_inode = get_inode(dir_ino, fs);
+	inode_wrlock(fs, dir_inode->inode_number);
+	if(dir_inode->dir_entries > 0){
+		inode_unlock(fs, dir_inode->inode_number);
+		inode_unlock(fs, parent_dir->inode_number);
+		return -ENOTEMPTY;
+	}
 
-	remove_entry(parent_dir, dir_entry, fs);
+	remove_entry(parent_dir, filename, fs);
+	parent_dir->links--;	// the removed directory's ".."
 	deallocate_inode(dir_inode, fs);
+	inode_unlock(fs, dir_inode->inode_number);
+	inode_unlock(fs, parent_dir->inode_number);
 	
-	return 0;
+	return sync_changed(parent_dir, fs);
 }
 
 /**
@@ -761,31 +499,16 @@ static int a1fs_rmdir(const char *path)
  *
  * @param path  path to the file to create.
  * @param mode  file mode bits.
- * @param fi    unused.
+ * @param fi    file info; fi->fh receives the handle of the new open file, as
+ *              in a1fs_open().
  * @return      0 on success; -errno on error.
  */
 static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	assert(S_ISREG(mode));
 	fs_ctx *fs = get_fs();
-
 	//TODO: create a file at given path with given mode
 
-	
-	int inode_number;
-	if((allocate_inode(&inode_number, fs)) != 0) return -ENOSPC;
-
-	a1fs_inode *inode = get_inode(inode_number, fs);
-	
-	inode->mode = mode;
-	inode->links = 1;
-	inode->size = 0;
-	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
-	inode->inode_number = inode_number;
-	inode->num_extents = 0;
-	inode->extents = -1;
-
 	//split path string into parent directory and filename
 	char filename[A1FS_NAME_MAX];
 	char parent_path[A1FS_PATH_MAX];
@@ -794,17 +517,21 @@ static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 	a1fs_inode *parent_dir;
 	path_lookup((const char *)(parent_path), &parent_dir, fs);
 
-	//append file to parent directory
-	//note that the only info given to the parent is relative to the inode
-	//hence the process of appending file is the same as that of a directory
-	add_dentry(parent_dir, filename, inode, fs);
-	
+	//allocated first so that running out of memory doesn't leave a new file behind
+	a1fs_handle *h = new_handle(0);
+	if(h == NULL) return -ENOMEM;
+	a1fs_inode *inode;
+	int error = create_node(parent_dir, filename, mode, &inode, fs);
+	if(error != 0){
+		free(h);
+		return error;
+	}
+	h->ino = inode->inode_number;
+	fi->fh = (uintptr_t)h;
 	return 0;
 }
 
 
-
-
 /**
  * Remove a file.
  *
@@ -813,7 +540,8 @@ static int a1fs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
  *
- * Errors: none
+ * Errors:
+ *   ENOENT  the file was removed meanwhile by another thread.
  *
  * @param path  path to the file to remove.
  * @return      0 on success; -errno on error.
@@ -835,13 +563,24 @@ static int a1fs_unlink(const char *path)
 	path_lookup((const char *)parent_path, &parent_dir, fs);
 
 	// int num_entries = parent_inode->size / sizeof(a1fs_dentry);
-	a1fs_dentry *inode_entry = get_entry(parent_dir, filename, fs);
-	a1fs_inode *inode = get_inode(inode_entry->ino, fs);
+	inode_wrlock(fs, parent_dir->inode_number);
+	//the entry may have been removed or renamed since FUSE looked it up
+	a1fs_ino_t ino;
+	int error = get_entry_ino(parent_dir, filename, &ino, fs);
+	if(error != 0){
+		inode_unlock(fs, parent_dir->inode_number);
+		return error;
+	}
+	a1fs_inode *inode = get_inode(ino, fs);
 
+	//wait for any reader or writer of the file to finish before freeing it
+	inode_wrlock(fs, inode->inode_number);
 	deallocate_inode(inode, fs);
-	remove_entry(parent_dir, inode_entry, fs);
+	remove_entry(parent_dir, filename, fs);
+	inode_unlock(fs, inode->inode_number);
+	inode_unlock(fs, parent_dir->inode_number);
 
-	return 0;
+	return sync_changed(parent_dir, fs);
 }
 
 
@@ -870,47 +609,37 @@ static int a1fs_utimens(const char *path, const struct timespec times[2])
 	// according to the utimensat man page
 	a1fs_inode *inode;
 	path_lookup(path, &inode, fs);
-	if(times[1].tv_nsec == UTIME_NOW){
-		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
-	}
-	else{
-		inode->mtime = times[1]; //times[1] is last modification time
-	}
-	
-	return 0;
+	return set_mtime(inode, (times[1].tv_nsec == UTIME_NOW) ? NULL : &times[1], fs);
 }
 
 
-int add_bytes(a1fs_inode *inode, int num_bytes, fs_ctx *fs){
-	int leftover_space;
-	if(inode->size % A1FS_BLOCK_SIZE == 0){
-		leftover_space = 0;
-	}else{
-		leftover_space = A1FS_BLOCK_SIZE - inode->size % A1FS_BLOCK_SIZE;
-	}
-	
-	if(inode->num_extents > 0){
-		memset(get_front(inode, fs), 0, leftover_space);
-	}
-	
-	if(leftover_space >= num_bytes) {
-		inode->size += num_bytes;
-		return 0;
-	}
+/**
+ * Get an extended attribute of a file or directory.
+ *
+ * Implements the getxattr() system call. The only attribute is
+ * A1FS_XATTR_EXTENTS, the number of extents holding the file's data as a
+ * decimal string, which lets tools measure fragmentation.
+ *
+ * Errors:
+ *   ENODATA  the attribute does not exist.
+ *   ERANGE   the value does not fit in size bytes.
+ *
+ * @param path   path to the file or directory.
+ * @param name   attribute name.
+ * @param value  buffer that receives the value (not null-terminated).
+ * @param size   size of the buffer; 0 to only query the size of the value.
+ * @return       size of the value on success; -errno on failure.
+ */
+static int a1fs_getxattr(const char *path, const char *name, char *value, size_t size)
+{
+	fs_ctx *fs = get_fs();
 
-	int num_blocks = round_up_divide(num_bytes - leftover_space, A1FS_BLOCK_SIZE);
-	if(allocate_blocks(inode, num_blocks, fs) != 0) return -ENOSPC;
-	inode->size += num_bytes;
-	return 0;
+	a1fs_inode *inode;
+	path_lookup(path, &inode, fs);
+	return get_xattr(inode, name, value, size, fs);
 }
 
-void reduce_bytes(a1fs_inode *inode, int num_bytes, fs_ctx *fs){
-	inode->size -= num_bytes;
-	int num_blocks = (num_bytes - inode->size % A1FS_BLOCK_SIZE) / A1FS_BLOCK_SIZE;
-	if(num_blocks > 0){
-		deallocate_blocks(inode, num_blocks, fs);
-	}
-}
+
 /**
  * Change the size of a file.
  *
@@ -924,6 +653,7 @@ void reduce_bytes(a1fs_inode *inode, int num_bytes, fs_ctx *fs){
  * Errors:
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
  *   ENOSPC  not enough free space in the file system.
+ *   EFBIG   the size is larger than the largest a1fs file.
  *
  * @param path  path to the file to set the size.
  * @param size  new file size in bytes.
@@ -935,34 +665,93 @@ static int a1fs_truncate(const char *path, off_t size)
 	//TODO: set new file size, possibly "zeroing out" the uninitialized range
 	a1fs_inode *inode;
 	path_lookup(path, &inode, fs);
-	if((uint64_t)size > inode->size){
-		int error;
-		if((error = add_bytes(inode, size, fs)) != 0) return error;
-	}
-	if((uint64_t)size < inode->size){
-		reduce_bytes(inode, inode->size - size, fs);
-	}
-	
+	return truncate_file(inode, size, fs);
+}
+
+/**
+ * Change the size of an open file.
+ *
+ * Implements the ftruncate() system call; see a1fs_truncate(). The file is
+ * found through its handle instead of its path.
+ *
+ * @param path  path to the file to set the size.
+ * @param size  new file size in bytes.
+ * @param fi    open file info; see a1fs_open().
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+	return truncate_file(file_inode(path, fi, fs), size, fs);
+}
+
+
+/**
+ * Open a file.
+ *
+ * Implements the open() system call. Keeps a handle of the open file in fi->fh
+ * (see a1fs_handle in file.h), so that the operations on the open file find it
+ * by inode number instead of walking its path each time, and reads and writes
+ * through it find their extents and read ahead from where the last one ended.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory for the handle.
+ *
+ * @param path  path to the file to open.
+ * @param fi    file info; fi->fh receives the handle.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_open(const char *path, struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+
+	a1fs_inode *inode;
+	path_lookup(path, &inode, fs);
+	a1fs_handle *h = new_handle(inode->inode_number);
+	if(h == NULL) return -ENOMEM;
+	fi->fh = (uintptr_t)h;
 	return 0;
 }
 
-void *get_byte(a1fs_inode *inode, int byte_number, fs_ctx *fs){
-	int data_block_number = -1;
-	int block_num_in_file = byte_number ? round_up_divide(byte_number, A1FS_BLOCK_SIZE) : 1;
-	a1fs_extent *extents = get_extents(inode, fs);
-	int count = 0;
-	for(int i = 0; i < inode->num_extents; i++){
-		a1fs_extent extent = extents[i];
-		count += extent.count;
-		if(count >= block_num_in_file){
-			data_block_number = extent.start + (count - block_num_in_file);
-			break;
-		}
-	}
+/**
+ * Open a directory.
+ *
+ * Implements the opendir() system call; see a1fs_open(). readdir() and
+ * fsyncdir() on the open directory find it through its handle.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory for the handle.
+ *
+ * @param path  path to the directory to open.
+ * @param fi    file info; fi->fh receives the handle.
+ * @return      0 on success; -errno on error.
+ */
+static int a1fs_opendir(const char *path, struct fuse_file_info *fi)
+{
+	return a1fs_open(path, fi);
+}
 
-	void *data_block = get_block(data_block_number, fs);
-	void *start_byte = data_block + byte_number % A1FS_BLOCK_SIZE;
-	return start_byte;
+/**
+ * Close a file or directory.
+ *
+ * Called once the last file descriptor referring to a file opened with
+ * a1fs_open(), a1fs_create() or a1fs_opendir() is closed. Frees its handle.
+ *
+ * @param path  path to the file, unused.
+ * @param fi    open file info.
+ * @return      0.
+ */
+static int a1fs_release(const char *path, struct fuse_file_info *fi)
+{
+	(void)path;// unused
+	free(get_handle(fi));
+	return 0;
 }
 
 /**
@@ -970,8 +759,8 @@ void *get_byte(a1fs_inode *inode, int byte_number, fs_ctx *fs){
  *
  * Implements the pread() system call. Must return exactly the number of bytes
  * requested except on EOF (end of file). Reads from file ranges that have not
- * been written to must return ranges filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * been written to must return ranges filled with zeros. The byte range from
+ * offset to offset + size may span any number of blocks and extents.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
@@ -982,34 +771,18 @@ void *get_byte(a1fs_inode *inode, int byte_number, fs_ctx *fs){
  * @param buf     pointer to the buffer that receives the data.
  * @param size    buffer size (number of bytes requested).
  * @param offset  offset from the beginning of the file to read from.
- * @param fi      unused.
+ * @param fi      open file info; see a1fs_open().
  * @return        number of bytes read on success; 0 if offset is beyond EOF;
  *                -errno on error.
  */
 static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
                      struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
 	//TODO: read data from the file at given offset into the buffer
 
-	a1fs_inode *inode;
-	path_lookup(path, &inode, fs);
-
-	if(offset > (int)inode->size || inode->size == 0) return 0;
-
-	void *start_byte = get_byte(inode, offset, fs);
-
-	int bytes_left_in_file = get_front(inode, fs) - start_byte;
-	if(bytes_left_in_file < (int)size){
-		memcpy(buf, start_byte, bytes_left_in_file);
-		memset(buf + bytes_left_in_file, 0, size - bytes_left_in_file);
-		return bytes_left_in_file;
-	}else{
-		memcpy(buf, start_byte, size);
-		return size;
-	}
+	return read_file(file_inode(path, fi, fs), buf, size, offset, get_handle(fi), fs);
 }
 
 /**
@@ -1018,8 +791,8 @@ static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
  * Implements the pwrite() system call. Must return exactly the number of bytes
  * requested except on error. If the offset is beyond EOF (end of file), the
  * file must be extended. If the write creates a "hole" of uninitialized data,
- * the new uninitialized range must filled with zeros. You can assume that the
- * byte range from offset to offset + size is contained within a single block.
+ * the new uninitialized range must filled with zeros. The byte range from
+ * offset to offset + size may span any number of blocks and extents.
  *
  * Assumptions (already verified by FUSE using getattr() calls):
  *   "path" exists and is a file.
@@ -1027,63 +800,200 @@ static int a1fs_read(const char *path, char *buf, size_t size, off_t offset,
  * Errors:
  *   ENOMEM  not enough memory (e.g. a malloc() call failed).
  *   ENOSPC  not enough free space in the file system.
+ *   EFBIG   the write ends past the largest a1fs file size.
  *
  * @param path    path to the file to write to.
  * @param buf     pointer to the buffer containing the data.
  * @param size    buffer size (number of bytes requested).
  * @param offset  offset from the beginning of the file to write to.
- * @param fi      unused.
+ * @param fi      open file info; see a1fs_open().
  * @return        number of bytes written on success; -errno on error.
  */
 static int a1fs_write(const char *path, const char *buf, size_t size,
                       off_t offset, struct fuse_file_info *fi)
 {
-	(void)fi;// unused
 	fs_ctx *fs = get_fs();
 
 	//TODO: write data from the buffer into the file at given offset, possibly
 	// "zeroing out" the uninitialized range
-	a1fs_inode *inode;
-	path_lookup(path, &inode, fs);
+	return write_file(file_inode(path, fi, fs), buf, size, offset, get_handle(fi), fs);
+}
 
-	//ensures file is initialized with at least 1 data block
-	if(size == 0) return 0;
-	if(inode->extents == -1){
-		if(allocate_blocks(inode, 0, fs) != 0) return -ENOSPC;
-	}
+/**
+ * Read data from a file into a buffer vector.
+ *
+ * Same as a1fs_read(), but instead of copying the data, returns a buffer vector
+ * with one entry per extent or hole in the range. The written blocks are passed
+ * as ranges of the image file (fs->dev.fd), so libfuse can copy or splice them
+ * to the kernel without going through a buffer of ours; holes and unwritten
+ * extents are passed as zeroed memory buffers. When the image file is not kept
+ * up to date (-o backend=pread, where changes may still be in the block cache),
+ * the data is copied into a single memory buffer instead, as in a1fs_read().
+ *
+ * libfuse reads the image ranges after this returns, without the inode lock.
+ * On a multithreaded mount (-o multithreaded), a truncate, hole punch or
+ * unlink running meanwhile could free the blocks and give them to another
+ * file, so the data is copied into a memory buffer under the lock there too.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory for the buffer vector.
+ *
+ * @param path    path to the file to read from.
+ * @param bufp    set to the buffer vector, allocated with malloc(); freed by libfuse.
+ * @param size    number of bytes requested.
+ * @param offset  offset from the beginning of the file to read from.
+ * @param fi      open file info; see a1fs_open().
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+                         struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
 
-	int error;
+	return read_file_buf(file_inode(path, fi, fs), bufp, size, offset, get_handle(fi), fs);
+}
 
-	if(offset > (int)inode->size){
-		int num_bytes_uninitialized = offset - inode->size;
-		//add bytes from start of file to offset, not they are initialized to 0 by add_bytes
-		if((error = add_bytes(inode, num_bytes_uninitialized, fs)) != 0) return error;
-	}
-	
-	int num_additional_bytes_needed = (offset + size) - inode->size;
-	if(num_additional_bytes_needed > 0){
-		if((error = add_bytes(inode, size, fs)) != 0) return error;
-	}
+/**
+ * Write data from a buffer vector to a file.
+ *
+ * Same as a1fs_write(), but the data comes in a buffer vector, which libfuse
+ * copies (or splices, when it holds a pipe) straight to the image file
+ * (fs->dev.fd), one extent at a time, without going through a buffer of ours.
+ * When the image file is not kept up to date (-o backend=pread), the data is
+ * copied into a buffer and written as in a1fs_write() instead.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC  not enough free space in the file system.
+ *   EFBIG   the write ends past the largest a1fs file size.
+ *   EIO     the data could not be copied from the buffer vector.
+ *
+ * @param path    path to the file to write to.
+ * @param buf     buffer vector holding the data.
+ * @param offset  offset from the beginning of the file to write to.
+ * @param fi      open file info; see a1fs_open().
+ * @return        number of bytes written on success; -errno on error.
+ */
+static int a1fs_write_buf(const char *path, struct fuse_bufvec *buf, off_t offset,
+                          struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
+
+	return write_file_buf(file_inode(path, fi, fs), buf, offset, get_handle(fi), fs);
+}
+
+/**
+ * Allocate or deallocate space for a range of a file.
+ *
+ * Implements the fallocate() system call. See "man 2 fallocate" for details.
+ * Supported modes:
+ *   0                    allocate blocks for the holes in the range and extend
+ *                        the file to cover it; new blocks read as zeros.
+ *   FALLOC_FL_KEEP_SIZE  the same without changing the file size, so the
+ *                        blocks past EOF are reserved for later writes.
+ *   FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE
+ *                        deallocate the blocks fully inside the range and zero
+ *                        the rest of the range; the size does not change.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   EINVAL      offset is negative or length is not positive.
+ *   EOPNOTSUPP  mode is not supported.
+ *   EFBIG       the range ends past the largest a1fs file size.
+ *   ENOMEM      not enough memory (e.g. a malloc() call failed).
+ *   ENOSPC      not enough free space in the file system.
+ *
+ * @param path    path to the file.
+ * @param mode    operation, see above.
+ * @param offset  offset of the range from the beginning of the file.
+ * @param length  length of the range in bytes.
+ * @param fi      open file info; see a1fs_open().
+ * @return        0 on success; -errno on error.
+ */
+static int a1fs_fallocate(const char *path, int mode, off_t offset, off_t length,
+                          struct fuse_file_info *fi)
+{
+	fs_ctx *fs = get_fs();
 
-	void *offset_byte = get_byte(inode, offset, fs);
-	memcpy(offset_byte, buf, size);
-	return size;
+	return fallocate_file(file_inode(path, fi, fs), mode, offset, length, fs);
+}
+
+
+
+/**
+ * Synchronize the contents of a file.
+ *
+ * Implements the fsync() and fdatasync() system calls. Writes back only the
+ * image blocks the file changed since its last fsync, along with its metadata,
+ * instead of the whole image. See sync_inode() in flush.h.
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a file.
+ *
+ * Errors:
+ *   EIO  the data could not be written back.
+ *
+ * @param path      path to the file.
+ * @param datasync  unused; the size and extents are needed to read the data
+ *                  back, so fdatasync() writes back the metadata too.
+ * @param fi        open file info; see a1fs_open().
+ * @return          0 on success; -errno on error.
+ */
+static int a1fs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	(void)datasync;// unused
+	fs_ctx *fs = get_fs();
+
+	return sync_inode(file_inode(path, fi, fs), fs);
+}
+
+/**
+ * Synchronize the contents of a directory.
+ *
+ * Implements the fsync() system call on a directory. See a1fs_fsync().
+ *
+ * Assumptions (already verified by FUSE using getattr() calls):
+ *   "path" exists and is a directory.
+ *
+ * @param path      path to the directory.
+ * @param datasync  unused.
+ * @param fi        open directory info; see a1fs_opendir().
+ * @return          0 on success; -errno on error.
+ */
+static int a1fs_fsyncdir(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	return a1fs_fsync(path, datasync, fi);
 }
 
 
 static struct fuse_operations a1fs_ops = {
+	.init     = a1fs_start,
 	.destroy  = a1fs_destroy,
 	.statfs   = a1fs_statfs,
 	.getattr  = a1fs_getattr,
+	.fgetattr = a1fs_fgetattr,
+	.opendir  = a1fs_opendir,
 	.readdir  = a1fs_readdir,
+	.releasedir = a1fs_release,
 	.mkdir    = a1fs_mkdir,
 	.rmdir    = a1fs_rmdir,
 	.create   = a1fs_create,
 	.unlink   = a1fs_unlink,
 	.utimens  = a1fs_utimens,
+	.getxattr = a1fs_getxattr,
 	.truncate = a1fs_truncate,
+	.ftruncate = a1fs_ftruncate,
+	.open     = a1fs_open,
+	.release  = a1fs_release,
 	.read     = a1fs_read,
 	.write    = a1fs_write,
+	.read_buf = a1fs_read_buf,
+	.write_buf = a1fs_write_buf,
+	.fallocate = a1fs_fallocate,
+	.fsync    = a1fs_fsync,
+	.fsyncdir = a1fs_fsyncdir,
 };
 
 int main(int argc, char *argv[])
@@ -1098,5 +1008,7 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	if (opts.lowlevel && !opts.help) return a1fs_ll_main(&args, &fs);
 	return fuse_main(args.argc, args.argv, &a1fs_ops, &fs);
 }
+
@@ -61,8 +61,53 @@ typedef struct a1fs_superblock {
 	a1fs_blk_t inode_bitmap;		// block number of the inode bitmap
 	a1fs_blk_t inode_table;			// block number of the inode table
 	a1fs_blk_t first_data_block;	// block number of the first datablock
+	unsigned int features;			// A1FS_FEATURE_* flags chosen by mkfs
+	unsigned int inode_size;		// bytes per inode in the inode table (A1FS_FEATURE_INLINE_DATA)
+	unsigned int groups_count;		// number of block groups (A1FS_FEATURE_BLOCK_GROUPS)
+	unsigned int inodes_per_group;	// inodes in the inode table slice of each group
+	a1fs_blk_t group_desc;			// block number of the group descriptor table
 } a1fs_superblock;
 
+/** Directories use variable length a1fs_dirent records instead of a1fs_dentry. */
+#define A1FS_FEATURE_COMPACT_DIRS 0x1
+
+/**
+ * Inodes are inode_size bytes long, a power of 2 larger than sizeof(a1fs_inode),
+ * and the space after the struct holds the data of small files (see
+ * A1FS_INODE_INLINE_DATA). Without this feature inodes are sizeof(a1fs_inode)
+ * bytes and inode_size is unused.
+ */
+#define A1FS_FEATURE_INLINE_DATA 0x2
+
+/**
+ * Files whose extents outgrow a single extent block keep them in a B+tree of
+ * blocks instead (see A1FS_INODE_EXTENT_TREE); without this feature a file has
+ * at most A1FS_BLOCK_SIZE / sizeof(a1fs_extent) extents.
+ */
+#define A1FS_FEATURE_EXTENT_TREE 0x4
+
+/**
+ * The data blocks are split into groups of A1FS_BLOCKS_PER_GROUP, each with its
+ * own slice of the inode table at its start and its own free counts in the
+ * group descriptor table (see a1fs_group_desc), so that files can be placed in
+ * the same group as their inodes. Without this feature there is one inode table
+ * before the data blocks, and groups_count, inodes_per_group and group_desc are
+ * unused.
+ */
+#define A1FS_FEATURE_BLOCK_GROUPS 0x8
+
+/**
+ * Inodes keep the number of blocks the file takes in blocks, so that it is known
+ * without walking the extent map. Without this feature blocks is left over
+ * padding of an older image, and the extent map is walked instead.
+ */
+#define A1FS_FEATURE_BLOCK_COUNT 0x10
+
+/** Feature flags understood by this version; images with any other are rejected. */
+#define A1FS_FEATURES_SUPPORTED (A1FS_FEATURE_COMPACT_DIRS | A1FS_FEATURE_INLINE_DATA | \
+                                 A1FS_FEATURE_EXTENT_TREE | A1FS_FEATURE_BLOCK_GROUPS | \
+                                 A1FS_FEATURE_BLOCK_COUNT)
+
 // Superblock must fit into a single block
 static_assert(sizeof(a1fs_superblock) <= A1FS_BLOCK_SIZE,
               "superblock is too large");
@@ -74,9 +119,89 @@ typedef struct a1fs_extent {
 	a1fs_blk_t start;
 	/** Number of blocks in the extent. */
 	a1fs_blk_t count;
+	/**
+	 * Index within the file of the first block of the extent (only meaningful
+	 * for the extents of a file). A file's extents are sorted by lblk, so the
+	 * extent holding a given file block can be found with a binary search.
+	 */
+	a1fs_blk_t lblk;
+	/** A1FS_EXTENT_* flags. */
+	uint32_t flags;
 
 } a1fs_extent;
 
+/**
+ * The blocks of the extent are allocated but were never written; their contents
+ * are garbage and the file reads as zeros there. Writing to such blocks splits
+ * the written part off into an ordinary extent.
+ */
+#define A1FS_EXTENT_UNWRITTEN 0x1
+
+static_assert(sizeof(a1fs_extent) == 16, "invalid extent size");
+
+/**
+ * Header of a node of an extent tree, at the start of its block.
+ *
+ * Leaves (depth 0) are followed by a1fs_extent entries sorted by lblk, index
+ * nodes by a1fs_extent_index entries pointing to the nodes one level down. All
+ * leaves are at the same depth, and no node but the root is ever empty.
+ */
+typedef struct a1fs_extent_node {
+	/** Number of levels below the node; 0 in a leaf. */
+	uint16_t depth;
+	/** Number of entries that follow the header. */
+	uint16_t entries;
+	/** Number of extents in the leaves under the node. */
+	uint32_t extents;
+	uint64_t padding;
+
+} a1fs_extent_node;
+
+/** Entry of an index node of an extent tree. */
+typedef struct a1fs_extent_index {
+	/**
+	 * No extent under this entry starts before lblk, and every extent under the
+	 * entries before it starts before lblk.
+	 */
+	a1fs_blk_t lblk;
+	/** Block of the node one level down. */
+	a1fs_blk_t block;
+	/** Number of extents under the entries before this one in the same node. */
+	uint32_t first;
+	uint32_t padding;
+
+} a1fs_extent_index;
+
+static_assert(sizeof(a1fs_extent_node) == sizeof(a1fs_extent), "invalid extent node size");
+static_assert(sizeof(a1fs_extent_index) == sizeof(a1fs_extent), "invalid extent index size");
+
+
+/** Number of data blocks in a block group, as many as one bitmap block maps. */
+#define A1FS_BLOCKS_PER_GROUP (A1FS_BLOCK_SIZE * 8)
+
+/**
+ * Entry of the group descriptor table (A1FS_FEATURE_BLOCK_GROUPS).
+ *
+ * Group g holds data blocks g * A1FS_BLOCKS_PER_GROUP onwards (fewer in the
+ * last group), and inodes g * inodes_per_group onwards. Its data bitmap is
+ * block g of the data bitmap, and its inode bitmap is its inodes' bits of the
+ * inode bitmap, so that both bitmaps are still single arrays of bits. Its slice
+ * of the inode table takes the first data blocks of the group, which are marked
+ * used in the data bitmap.
+ */
+typedef struct a1fs_group_desc {
+	/** Block number of the group's slice of the inode table. */
+	a1fs_blk_t inode_table;
+	/** Number of unused data blocks in the group. */
+	uint32_t free_blocks_count;
+	/** Number of unused inodes in the group. */
+	uint32_t free_inodes_count;
+	uint32_t padding;
+
+} a1fs_group_desc;
+
+static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_group_desc) == 0, "invalid group descriptor size");
+
 
 /** a1fs inode. */
 typedef struct a1fs_inode {
@@ -115,20 +240,69 @@ typedef struct a1fs_inode {
 	//The index of the inode in the inode bitmap
 	uint32_t inode_number;
 
-	//The number of extents in the file
+	//The number of extents in the file, unless they are in an extent tree
 	uint16_t num_extents;
 
-	//The pointer to the data block containing extents
+	//The number of blocks in the directory's hash index, 0 if it has none
+	uint16_t dir_index_blocks;
+
+	//The pointer to the data block containing extents, -1 if there is none
+	//(also when the extents are in the inode, see A1FS_INODE_INLINE_EXTENTS), or
+	//to the root of the extent tree (see A1FS_INODE_EXTENT_TREE)
 	int32_t extents;
+
+	//The first data block of the directory's hash index; its blocks are contiguous
+	a1fs_blk_t dir_index;
+
+	//The number of entries in the directory
+	uint32_t dir_entries;
+
+	//A1FS_INODE_* flags
+	uint16_t flags;
+
+	//2 bytes of padding to align blocks
+	uint8_t flags_padding[2];
+
+	//The number of data blocks of the file and of its extent map, not counting the
+	//directory's hash index (A1FS_FEATURE_BLOCK_COUNT)
+	a1fs_blk_t blocks;
 	
-	//18 bytes of padding to make size of struct 64 bytes
-	uint8_t padding[18];
+	//4 bytes of padding to make size of struct 64 bytes, spelled out so that the
+	//layout does not depend on the alignment the compiler adds
+	uint8_t padding[4];
 
 } a1fs_inode;
 
+static_assert(sizeof(a1fs_inode) == 64, "invalid inode size");
 // A single block must fit an integral number of inodes
 static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_inode) == 0, "invalid inode size");
 
+/**
+ * The data of the file is stored in the inode itself, in the bytes that follow
+ * the struct in an inode of inode_size bytes (A1FS_FEATURE_INLINE_DATA), and the
+ * file has no extents. Bytes past the end of the file are kept zero. Regular
+ * files start out inline and move to extents once they outgrow the inode.
+ */
+#define A1FS_INODE_INLINE_DATA 0x1
+
+/**
+ * The extents of the file are stored in the inode itself, in the same bytes that
+ * would hold inline data, instead of in the block at extents (which is then -1).
+ * Files and directories get as many extent slots as fit there; the extents move to
+ * a block of their own once the slots are full.
+ */
+#define A1FS_INODE_INLINE_EXTENTS 0x2
+
+/**
+ * The block at extents is the root index node of a B+tree of extents rather than
+ * an array of num_extents extents (A1FS_FEATURE_EXTENT_TREE); num_extents is 0
+ * and the number of extents is in the header of the root.
+ */
+#define A1FS_INODE_EXTENT_TREE 0x4
+
+/** Largest inode size mkfs accepts; inline data must stay well below a block. */
+#define A1FS_INODE_SIZE_MAX 1024
+
 
 /** Maximum file name (path component) length. Includes the null terminator. */
 #define A1FS_NAME_MAX 252
@@ -146,3 +320,70 @@ typedef struct a1fs_dentry {
 } a1fs_dentry;
 
 static_assert(sizeof(a1fs_dentry) == 256, "invalid dentry size");
+
+/**
+ * Variable length directory entry, used when the superblock has
+ * A1FS_FEATURE_COMPACT_DIRS.
+ *
+ * Each directory block is covered by a chain of records; rec_len of each record
+ * leads to the next one and the records of a block add up to A1FS_BLOCK_SIZE.
+ * Records never span blocks, so the directory size is always a whole number of
+ * blocks. A record with name_len 0 is unused (only the first record of a block
+ * can be; free space after a used record is part of its rec_len).
+ */
+typedef struct a1fs_dirent {
+	/** Inode number. */
+	a1fs_ino_t ino;
+	/** Size of the record in bytes, including any slack after the name. */
+	uint16_t rec_len;
+	/** Length of the name, not counting the null terminator; 0 if unused. */
+	uint16_t name_len;
+	/** File name. A null-terminated string. */
+	char name[];
+
+} a1fs_dirent;
+
+static_assert(sizeof(a1fs_dirent) == 8, "invalid dirent size");
+
+/** Smallest record that can hold a name of name_len characters, 4-byte aligned. */
+static inline uint16_t a1fs_dirent_size(uint16_t name_len)
+{
+	return (sizeof(a1fs_dirent) + name_len + 1 + 3) & ~3u;
+}
+
+
+/**
+ * Number of entries at which a directory gets a hash index. Smaller directories
+ * only use the flat array of entries; the index is dropped again once a
+ * directory shrinks below half of this.
+ */
+#define A1FS_DIR_INDEX_MIN_ENTRIES 64
+
+/**
+ * Directory hash index slot.
+ *
+ * The index is an open addressing hash table (linear probing) stored in a
+ * contiguous run of blocks, with a power of 2 number of slots. It maps the
+ * a1fs_name_hash() of each entry name to the byte offset of the entry in the
+ * directory. The table is kept at most 3/4 full.
+ */
+typedef struct a1fs_dir_index_slot {
+	/** Hash of the entry name. */
+	uint32_t hash;
+	/** Byte offset of the entry in the directory plus one; 0 for an empty slot. */
+	uint32_t pos;
+
+} a1fs_dir_index_slot;
+
+static_assert(A1FS_BLOCK_SIZE % sizeof(a1fs_dir_index_slot) == 0,
+              "invalid dir index slot size");
+
+/** Hash of a file name used by directory indexes (32-bit FNV-1a). */
+static inline uint32_t a1fs_name_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+	for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+		hash = (hash ^ *c) * 16777619u;
+	}
+	return hash;
+}
@@ -0,0 +1,765 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs low-level driver implementation.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse_lowlevel.h>
+
+#include "a1fs.h"
+#include "a1fs_ll.h"
+#include "alloc.h"
+#include "bitmap.h"
+#include "dir.h"
+#include "file.h"
+#include "flush.h"
+
+//NOTE: the node id of a1fs inode ino is ino + 1, since node id 0 is invalid
+// and the root directory (inode 0) must be FUSE_ROOT_ID (1).
+//
+// The kernel counts the replies that give it a node id (lookup(), mkdir() and
+// create()) and forgets them with forget() once it drops the inode from its
+// cache. A file removed while the kernel still knows its node id (e.g. it is
+// open) keeps its inode, with no links, until the last forget(); if the file
+// system is not unmounted cleanly, such inodes are freed at the next mount.
+//
+// The callbacks below mostly reply with the result of the operation in file.h
+// that the callback of the same name in a1fs.c uses; see there for details.
+
+
+/** How long the kernel may cache names and attributes, in seconds. */
+#define A1FS_LL_TIMEOUT 1.0
+
+/** Inode number reported for "..", which a1fs directories do not store. */
+#define A1FS_LL_UNKNOWN_INO 0xffffffff
+
+/** What the kernel holds of an inode. */
+typedef struct ll_node {
+	/** Number of node ids given to the kernel and not forgotten yet. */
+	uint64_t lookups;
+	/** Whether the file has been removed; its inode is freed once lookups drops to 0. */
+	bool unlinked;
+
+} ll_node;
+
+/** Low-level driver state; the user data of the session. */
+typedef struct ll_ctx {
+	/** The mounted file system. */
+	fs_ctx *fs;
+	/** Kernel references to each inode, indexed by inode number. */
+	ll_node *nodes;
+	/** Protects nodes. */
+	pthread_mutex_t nodes_lock;
+
+} ll_ctx;
+
+/** Directory listing made by a1fs_ll_opendir(), kept in fi->fh until releasedir(). */
+typedef struct ll_dir {
+	/** Entries in the format of fuse_add_direntry(). */
+	char *buf;
+	/** Size of the entries in buf, in bytes. */
+	size_t size;
+	/** Size of buf, in bytes. */
+	size_t capacity;
+	/** Request the listing is made for; needed by fuse_add_direntry(). */
+	fuse_req_t req;
+
+} ll_dir;
+
+
+static a1fs_ino_t node_ino(fuse_ino_t node)
+{
+	return (a1fs_ino_t)(node - 1);
+}
+
+static fuse_ino_t ino_node(a1fs_ino_t ino)
+{
+	return (fuse_ino_t)ino + 1;
+}
+
+// Get the driver state. Must be called at the start of each callback, before
+// any blocks of the image are used (see get_fs() in a1fs.c).
+static ll_ctx *get_ll(fuse_req_t req)
+{
+	ll_ctx *ll = (ll_ctx*)fuse_req_userdata(req);
+	bdev_release(&ll->fs->dev);
+	return ll;
+}
+
+static a1fs_inode *node_inode(ll_ctx *ll, fuse_ino_t node)
+{
+	return get_inode(node_ino(node), ll->fs);
+}
+
+static void reply_status(fuse_req_t req, int error)
+{
+	fuse_reply_err(req, -error);
+}
+
+
+// Count a node id given to the kernel. Called while holding a lock that keeps
+// the inode from being removed (its directory's or its own).
+static void add_lookup(ll_ctx *ll, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&ll->nodes_lock);
+	ll->nodes[ino].lookups++;
+	pthread_mutex_unlock(&ll->nodes_lock);
+}
+
+// Free the inode of a removed file that the kernel no longer knows
+static void free_inode(a1fs_ino_t ino, fs_ctx *fs)
+{
+	a1fs_inode *inode = get_inode(ino, fs);
+	inode_wrlock(fs, ino);
+	deallocate_inode(inode, fs);
+	inode_unlock(fs, ino);
+	sync_changed(inode, fs);
+	// Only the blocks used until now were changed (see bdev_writing())
+	bdev_release(&fs->dev);
+}
+
+// Drop count node ids of inode ino, freeing it if it has been removed and they
+// were the last ones
+static void drop_lookups(ll_ctx *ll, a1fs_ino_t ino, uint64_t count)
+{
+	pthread_mutex_lock(&ll->nodes_lock);
+	ll_node *node = &ll->nodes[ino];
+	node->lookups -= count;
+	bool last = (node->lookups == 0) && node->unlinked;
+	if (last) node->unlinked = false;
+	pthread_mutex_unlock(&ll->nodes_lock);
+	if (last) free_inode(ino, ll->fs);
+}
+
+// Free the inodes that are in use but have no links, i.e. files removed while
+// the kernel still knew them and the file system was not unmounted cleanly
+static void free_unlinked(fs_ctx *fs)
+{
+	unsigned char *bitmap = get_bitmap('i', fs);
+	uint32_t count = fs->sb->inodes_count;
+	for (uint32_t ino = bitmap_find_next(bitmap, count, 0, true); ino < count;
+	     ino = bitmap_find_next(bitmap, count, ino + 1, true))
+	{
+		a1fs_inode *inode = get_inode(ino, fs);
+		bool unlinked = (inode->links == 0);
+		put_block(inode, fs);
+		if (unlinked) free_inode(ino, fs);
+	}
+}
+
+
+// Fill st with the attributes of inode, as the kernel sees them
+static void fill_attr(ll_ctx *ll, a1fs_inode *inode, struct stat *st)
+{
+	stat_inode(inode, st, ll->fs);
+	st->st_ino = ino_node(inode->inode_number);
+}
+
+// Reply to a request that looked up inode; the lookup must be counted already
+static void reply_entry(fuse_req_t req, ll_ctx *ll, a1fs_inode *inode,
+                        struct fuse_file_info *fi)
+{
+	struct fuse_entry_param e;
+	memset(&e, 0, sizeof(e));
+	e.ino = ino_node(inode->inode_number);
+	e.attr_timeout = A1FS_LL_TIMEOUT;
+	e.entry_timeout = A1FS_LL_TIMEOUT;
+	fill_attr(ll, inode, &e.attr);
+	if (fi != NULL) {
+		// Release is not called for a file whose open failed to be replied to
+		if (fuse_reply_create(req, &e, fi) != 0) free((void*)(uintptr_t)fi->fh);
+	} else {
+		fuse_reply_entry(req, &e);
+	}
+}
+
+
+/**
+ * Initialize the file system once it is mounted; see a1fs_start().
+ */
+static void a1fs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	(void)conn;// unused
+	fs_ctx *fs = ((ll_ctx*)userdata)->fs;
+	if (!flusher_start(fs)) {
+		fprintf(stderr, "Failed to start the flusher thread; using sync=always\n");
+		fs->sync_mode = A1FS_SYNC_ALWAYS;
+	}
+}
+
+/**
+ * Cleanup the file system; see a1fs_destroy(). Inodes of removed files are
+ * freed, since the kernel has dropped all node ids.
+ */
+static void a1fs_ll_destroy(void *userdata)
+{
+	ll_ctx *ll = (ll_ctx*)userdata;
+	fs_ctx *fs = ll->fs;
+	if (fs->dev.ops == NULL) return;
+
+	bdev_release(&fs->dev);
+	for (a1fs_ino_t ino = 0; (ll->nodes != NULL) && (ino < fs->sb->inodes_count); ino++) {
+		if (ll->nodes[ino].unlinked) {
+			ll->nodes[ino].lookups = 0;
+			ll->nodes[ino].unlinked = false;
+			free_inode(ino, fs);
+		}
+	}
+	flusher_stop(fs);
+	fs_ctx_destroy(fs);
+}
+
+/**
+ * Look up a directory entry and get its attributes.
+ *
+ * A missing entry is replied to with node id 0, which the kernel caches as a
+ * negative entry for A1FS_LL_TIMEOUT, like a name it has found.
+ *
+ * Errors:
+ *   ENAMETOOLONG  the name is too long.
+ *
+ * @param parent  node id of the directory.
+ * @param name    name to look up.
+ */
+static void a1fs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	ll_ctx *ll = get_ll(req);
+	fs_ctx *fs = ll->fs;
+	if (strlen(name) >= A1FS_NAME_MAX) {
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+
+	a1fs_inode *directory = node_inode(ll, parent);
+	a1fs_ino_t ino;
+	inode_rdlock(fs, directory->inode_number);
+	int error = get_entry_ino(directory, name, &ino, fs);
+	if (error == 0) add_lookup(ll, ino);
+	inode_unlock(fs, directory->inode_number);
+
+	if (error == -ENOENT) {
+		struct fuse_entry_param e;
+		memset(&e, 0, sizeof(e));
+		e.entry_timeout = A1FS_LL_TIMEOUT;
+		fuse_reply_entry(req, &e);
+		return;
+	}
+	if (error != 0) {
+		reply_status(req, error);
+		return;
+	}
+	reply_entry(req, ll, get_inode(ino, fs), NULL);
+}
+
+/**
+ * Forget nlookup node ids of a file given by lookup(), mkdir() or create().
+ */
+static void a1fs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	ll_ctx *ll = get_ll(req);
+	drop_lookups(ll, node_ino(ino), nlookup);
+	fuse_reply_none(req);
+}
+
+/**
+ * Get file or directory attributes; see a1fs_getattr().
+ */
+static void a1fs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	ll_ctx *ll = get_ll(req);
+	struct stat st;
+	fill_attr(ll, node_inode(ll, ino), &st);
+	fuse_reply_attr(req, &st, A1FS_LL_TIMEOUT);
+}
+
+/**
+ * Change file attributes. Implements truncate() and utimensat(); see
+ * a1fs_truncate() and a1fs_utimens(). The access time is not stored.
+ *
+ * Errors:
+ *   ENOSYS  the mode or owner is to be changed, which a1fs does not support.
+ *   EFBIG   the size is larger than the largest a1fs file.
+ *   ENOSPC  not enough free space in the file system.
+ */
+static void a1fs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                            int to_set, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	ll_ctx *ll = get_ll(req);
+	fs_ctx *fs = ll->fs;
+	a1fs_inode *inode = node_inode(ll, ino);
+
+	if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+		fuse_reply_err(req, ENOSYS);
+		return;
+	}
+	int error = 0;
+	if (to_set & FUSE_SET_ATTR_SIZE) error = truncate_file(inode, attr->st_size, fs);
+	if ((error == 0) && (to_set & FUSE_SET_ATTR_MTIME_NOW)) {
+		error = set_mtime(inode, NULL, fs);
+	} else if ((error == 0) && (to_set & FUSE_SET_ATTR_MTIME)) {
+		error = set_mtime(inode, &attr->st_mtim, fs);
+	}
+	if (error != 0) {
+		reply_status(req, error);
+		return;
+	}
+
+	struct stat st;
+	fill_attr(ll, inode, &st);
+	fuse_reply_attr(req, &st, A1FS_LL_TIMEOUT);
+}
+
+// Create a file or directory for mkdir() and create()
+static void make_node(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                      struct fuse_file_info *fi)
+{
+	ll_ctx *ll = get_ll(req);
+	if (strlen(name) >= A1FS_NAME_MAX) {
+		fuse_reply_err(req, ENAMETOOLONG);
+		return;
+	}
+
+	// Allocated first so that running out of memory does not leave a new file behind
+	a1fs_handle *h = NULL;
+	if ((fi != NULL) && ((h = new_handle(0)) == NULL)) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+
+	a1fs_inode *inode;
+	int error = create_node(node_inode(ll, parent), name, mode, &inode, ll->fs);
+	if (error != 0) {
+		free(h);
+		reply_status(req, error);
+		return;
+	}
+	// The kernel holds the directory, so nothing can remove the file yet
+	add_lookup(ll, inode->inode_number);
+	if (fi != NULL) {
+		h->ino = inode->inode_number;
+		fi->fh = (uintptr_t)h;
+	}
+	reply_entry(req, ll, inode, fi);
+}
+
+/**
+ * Create a directory; see a1fs_mkdir().
+ *
+ * Errors:
+ *   ENAMETOOLONG  the name is too long.
+ *   ENOSPC        not enough free space in the file system.
+ */
+static void a1fs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	make_node(req, parent, name, mode | S_IFDIR, NULL);
+}
+
+/**
+ * Create and open a file; see a1fs_create().
+ *
+ * Errors:
+ *   ENAMETOOLONG  the name is too long.
+ *   ENOSPC        not enough free space in the file system.
+ */
+static void a1fs_ll_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode,
+                           struct fuse_file_info *fi)
+{
+	make_node(req, parent, name, mode, fi);
+}
+
+// Remove the entry name from directory parent for unlink() and rmdir(). The
+// inode is freed now if the kernel has forgotten it, otherwise on the last forget
+static int remove_node(ll_ctx *ll, fuse_ino_t parent, const char *name, bool is_dir)
+{
+	fs_ctx *fs = ll->fs;
+	a1fs_inode *parent_dir = node_inode(ll, parent);
+
+	//lock order is always parent before child
+	inode_wrlock(fs, parent_dir->inode_number);
+	a1fs_ino_t ino;
+	int error = get_entry_ino(parent_dir, name, &ino, fs);
+	if (error != 0) {
+		inode_unlock(fs, parent_dir->inode_number);
+		return error;
+	}
+	a1fs_inode *inode = get_inode(ino, fs);
+	inode_wrlock(fs, ino);
+	if (is_dir && (inode->dir_entries > 0)) {
+		error = -ENOTEMPTY;
+	} else {
+		remove_entry(parent_dir, name, fs);
+		if (is_dir) parent_dir->links--;// the removed directory's ".."
+		inode->links = 0;
+
+		pthread_mutex_lock(&ll->nodes_lock);
+		bool known = ll->nodes[ino].lookups > 0;
+		ll->nodes[ino].unlinked = known;
+		pthread_mutex_unlock(&ll->nodes_lock);
+		if (!known) deallocate_inode(inode, fs);
+	}
+	inode_unlock(fs, ino);
+	inode_unlock(fs, parent_dir->inode_number);
+
+	return (error != 0) ? error : sync_changed(parent_dir, fs);
+}
+
+/**
+ * Remove a file; see a1fs_unlink().
+ */
+static void a1fs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	ll_ctx *ll = get_ll(req);
+	reply_status(req, remove_node(ll, parent, name, false));
+}
+
+/**
+ * Remove a directory; see a1fs_rmdir().
+ *
+ * Errors:
+ *   ENOTEMPTY  the directory is not empty.
+ */
+static void a1fs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	ll_ctx *ll = get_ll(req);
+	reply_status(req, remove_node(ll, parent, name, true));
+}
+
+// Append an entry to a directory listing; dir_foreach() callback
+static int add_dirent(const char *name, a1fs_ino_t ino, uint64_t pos, void *arg)
+{
+	(void)pos;// unused
+	ll_dir *dir = (ll_dir*)arg;
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	st.st_ino = (ino == A1FS_LL_UNKNOWN_INO) ? ino : ino_node(ino);
+
+	size_t len = fuse_add_direntry(dir->req, NULL, 0, name, NULL, 0);
+	if (dir->size + len > dir->capacity) {
+		size_t capacity = (dir->capacity > 0) ? dir->capacity * 2 : A1FS_BLOCK_SIZE;
+		while (dir->size + len > capacity) capacity *= 2;
+		char *buf = realloc(dir->buf, capacity);
+		if (buf == NULL) return -ENOMEM;
+		dir->buf = buf;
+		dir->capacity = capacity;
+	}
+	// The offset of an entry is where the next one starts
+	fuse_add_direntry(dir->req, dir->buf + dir->size, len, name, &st, dir->size + len);
+	dir->size += len;
+	return 0;
+}
+
+/**
+ * Open a directory.
+ *
+ * Lists the whole directory, so that readdir() calls continuing the listing
+ * see the entries as they were when it was opened, like the listing libfuse
+ * makes for the driver in a1fs.c.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory for the listing.
+ */
+static void a1fs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	ll_ctx *ll = get_ll(req);
+	fs_ctx *fs = ll->fs;
+	ll_dir *dir = calloc(1, sizeof(ll_dir));
+	if (dir == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	dir->req = req;
+
+	a1fs_inode *directory = node_inode(ll, ino);
+	a1fs_ino_t parent = (ino == FUSE_ROOT_ID) ? 0 : A1FS_LL_UNKNOWN_INO;
+	int error = add_dirent(".", directory->inode_number, 0, dir);
+	if (error == 0) error = add_dirent("..", parent, 0, dir);
+	if (error == 0) {
+		inode_rdlock(fs, directory->inode_number);
+		error = dir_foreach(directory, add_dirent, dir, fs);
+		inode_unlock(fs, directory->inode_number);
+	}
+	if (error != 0) {
+		free(dir->buf);
+		free(dir);
+		reply_status(req, error);
+		return;
+	}
+
+	fi->fh = (uintptr_t)dir;
+	if (fuse_reply_open(req, fi) != 0) {
+		// The kernel will not release it
+		free(dir->buf);
+		free(dir);
+	}
+}
+
+/**
+ * Read the directory listing made by opendir() from offset off.
+ */
+static void a1fs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                            struct fuse_file_info *fi)
+{
+	(void)ino;// unused
+	ll_dir *dir = (ll_dir*)(uintptr_t)fi->fh;
+	if ((size_t)off >= dir->size) {
+		fuse_reply_buf(req, NULL, 0);
+		return;
+	}
+	// The kernel only takes the entries that fit whole
+	size_t left = dir->size - off;
+	fuse_reply_buf(req, dir->buf + off, (size < left) ? size : left);
+}
+
+/**
+ * Free the directory listing made by opendir().
+ */
+static void a1fs_ll_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void)ino;// unused
+	ll_dir *dir = (ll_dir*)(uintptr_t)fi->fh;
+	free(dir->buf);
+	free(dir);
+	fuse_reply_err(req, 0);
+}
+
+/**
+ * Open a file; see a1fs_open(). The file is already known by its node id; the
+ * handle keeps where the last access ended, for the next one.
+ *
+ * Errors:
+ *   ENOMEM  not enough memory for the handle.
+ */
+static void a1fs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	a1fs_handle *h = new_handle(node_ino(ino));
+	if (h == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	fi->fh = (uintptr_t)h;
+	// Release is not called for a file whose open failed to be replied to
+	if (fuse_reply_open(req, fi) != 0) free(h);
+}
+
+/**
+ * Close a file; see a1fs_release().
+ */
+static void a1fs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	(void)ino;// unused
+	free((a1fs_handle*)(uintptr_t)fi->fh);
+	fuse_reply_err(req, 0);
+}
+
+// Handle of an open file, NULL for requests on a file that was not opened
+static a1fs_handle *get_handle(struct fuse_file_info *fi)
+{
+	return (fi != NULL) ? (a1fs_handle*)(uintptr_t)fi->fh : NULL;
+}
+
+/**
+ * Read data from a file; see a1fs_read_buf().
+ */
+static void a1fs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                         struct fuse_file_info *fi)
+{
+	ll_ctx *ll = get_ll(req);
+	struct fuse_bufvec *bufv;
+	int error = read_file_buf(node_inode(ll, ino), &bufv, size, off, get_handle(fi), ll->fs);
+	if (error != 0) {
+		reply_status(req, error);
+		return;
+	}
+	fuse_reply_data(req, bufv, FUSE_BUF_SPLICE_MOVE);
+	free_bufvec(bufv);
+}
+
+/**
+ * Write data to a file; see a1fs_write().
+ */
+static void a1fs_ll_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                          off_t off, struct fuse_file_info *fi)
+{
+	ll_ctx *ll = get_ll(req);
+	int ret = write_file(node_inode(ll, ino), buf, size, off, get_handle(fi), ll->fs);
+	if (ret < 0) {
+		reply_status(req, ret);
+	} else {
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * Write data from a buffer vector to a file; see a1fs_write_buf().
+ */
+static void a1fs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *bufv,
+                              off_t off, struct fuse_file_info *fi)
+{
+	ll_ctx *ll = get_ll(req);
+	int ret = write_file_buf(node_inode(ll, ino), bufv, off, get_handle(fi), ll->fs);
+	if (ret < 0) {
+		reply_status(req, ret);
+	} else {
+		fuse_reply_write(req, ret);
+	}
+}
+
+/**
+ * Allocate or deallocate space for a range of a file; see a1fs_fallocate().
+ */
+static void a1fs_ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                              off_t length, struct fuse_file_info *fi)
+{
+	(void)fi;// unused
+	ll_ctx *ll = get_ll(req);
+	reply_status(req, fallocate_file(node_inode(ll, ino), mode, offset, length, ll->fs));
+}
+
+/**
+ * Synchronize the contents of a file or directory; see a1fs_fsync().
+ */
+static void a1fs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync,
+                          struct fuse_file_info *fi)
+{
+	(void)datasync;// unused
+	(void)fi;// unused
+	ll_ctx *ll = get_ll(req);
+	reply_status(req, sync_inode(node_inode(ll, ino), ll->fs));
+}
+
+/**
+ * Get an extended attribute of a file or directory; see a1fs_getxattr().
+ */
+static void a1fs_ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size)
+{
+	ll_ctx *ll = get_ll(req);
+	char value[16];
+	int len = get_xattr(node_inode(ll, ino), name, value, sizeof(value), ll->fs);
+	if (len < 0) {
+		reply_status(req, len);
+	} else if (size == 0) {
+		fuse_reply_xattr(req, len);
+	} else if (size < (size_t)len) {
+		fuse_reply_err(req, ERANGE);
+	} else {
+		fuse_reply_buf(req, value, len);
+	}
+}
+
+/**
+ * Get file system statistics; see a1fs_statfs().
+ */
+static void a1fs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	(void)ino;// unused
+	fs_ctx *fs = get_ll(req)->fs;
+
+	struct statvfs st;
+	memset(&st, 0, sizeof(st));
+	st.f_bsize   = A1FS_BLOCK_SIZE;
+	st.f_frsize  = A1FS_BLOCK_SIZE;
+	st.f_blocks  = fs->dev.size / A1FS_BLOCK_SIZE;
+	st.f_bfree   = fs->sb->free_blocks_count;
+	st.f_bavail  = fs->sb->free_blocks_count;
+	st.f_files   = fs->sb->inodes_count;
+	st.f_ffree   = fs->sb->free_inodes_count;
+	st.f_favail  = fs->sb->free_inodes_count;
+	st.f_namemax = A1FS_NAME_MAX;
+	fuse_reply_statfs(req, &st);
+}
+
+
+static struct fuse_lowlevel_ops a1fs_ll_ops = {
+	.init       = a1fs_ll_init,
+	.destroy    = a1fs_ll_destroy,
+	.lookup     = a1fs_ll_lookup,
+	.forget     = a1fs_ll_forget,
+	.getattr    = a1fs_ll_getattr,
+	.setattr    = a1fs_ll_setattr,
+	.mkdir      = a1fs_ll_mkdir,
+	.unlink     = a1fs_ll_unlink,
+	.rmdir      = a1fs_ll_rmdir,
+	.create     = a1fs_ll_create,
+	.open       = a1fs_ll_open,
+	.release    = a1fs_ll_release,
+	.opendir    = a1fs_ll_opendir,
+	.readdir    = a1fs_ll_readdir,
+	.releasedir = a1fs_ll_releasedir,
+	.read       = a1fs_ll_read,
+	.write      = a1fs_ll_write,
+	.write_buf  = a1fs_ll_write_buf,
+	.fallocate  = a1fs_ll_fallocate,
+	.fsync      = a1fs_ll_fsync,
+	.fsyncdir   = a1fs_ll_fsync,
+	.getxattr   = a1fs_ll_getxattr,
+	.statfs     = a1fs_ll_statfs,
+};
+
+// Mount at the mount point given in args and serve requests until unmounted,
+// the way fuse_main() does for the high-level API
+static int serve(struct fuse_args *args, ll_ctx *ll)
+{
+	char *mountpoint;
+	int multithreaded, foreground;
+	if (fuse_parse_cmdline(args, &mountpoint, &multithreaded, &foreground) == -1) return -1;
+
+	int err = -1;
+	struct fuse_chan *ch = fuse_mount(mountpoint, args);
+	if (ch != NULL) {
+		struct fuse_session *se = fuse_lowlevel_new(args, &a1fs_ll_ops, sizeof(a1fs_ll_ops), ll);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) != -1) {
+				fuse_session_add_chan(se, ch);
+				if (fuse_daemonize(foreground) != -1) {
+					err = multithreaded ? fuse_session_loop_mt(se) : fuse_session_loop(se);
+				}
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	return err;
+}
+
+int a1fs_ll_main(struct fuse_args *args, fs_ctx *fs)
+{
+	ll_ctx ll = {.fs = fs};
+	ll.nodes = calloc(fs->sb->inodes_count, sizeof(ll_node));
+	int err = -1;
+	if ((ll.nodes != NULL) && (pthread_mutex_init(&ll.nodes_lock, NULL) == 0)) {
+		free_unlinked(fs);
+		err = serve(args, &ll);
+		pthread_mutex_destroy(&ll.nodes_lock);
+	}
+
+	// The session only calls destroy() if the kernel initialized it
+	a1fs_ll_destroy(&ll);
+	free(ll.nodes);
+	fuse_opt_free_args(args);
+	return (err == 0) ? 0 : 1;
+}
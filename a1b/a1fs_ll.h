@@ -0,0 +1,40 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - a1fs low-level driver header file.
+ */
+
+#pragma once
+
+#include <fuse_opt.h>
+
+#include "fs_ctx.h"
+
+
+//NOTE: the low-level driver (-o lowlevel) serves the same file system as the
+// driver in a1fs.c, but through the FUSE low-level API, where requests name
+// files by node id instead of by path. Node ids are a1fs inode numbers, so no
+// request walks a path: the kernel looks each name up once and caches the
+// result in its dentry cache.
+
+/**
+ * Mount the file system and serve requests with the low-level driver until it
+ * is unmounted. Used instead of fuse_main().
+ *
+ * @param args  command line arguments left over by a1fs_opt_parse(); freed.
+ * @param fs    initialized file system context; destroyed when unmounted.
+ * @return      exit status: 0 on success; 1 on failure.
+ */
+int a1fs_ll_main(struct fuse_args *args, fs_ctx *fs);
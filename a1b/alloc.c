@@ -0,0 +1,497 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode and data block allocation implementation.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "extent.h"
+
+
+/**
+ * record that count bits starting at bit first_bit of the bitmap starting at block
+ * map_start changed, so that the next fsync writes the bitmap blocks holding them back
+**/
+static void mark_bitmap_dirty(a1fs_blk_t map_start, uint32_t first_bit, uint32_t count, fs_ctx *fs){
+	uint32_t bits_per_block = A1FS_BLOCK_SIZE * 8;
+	uint32_t first = first_bit / bits_per_block;
+	uint32_t last = (first_bit + count - 1) / bits_per_block;
+	dirty_add(&fs->dirty_bitmaps, (uint64_t)map_start + first, last - first + 1);
+}
+
+/**
+ * take count bits starting at bit first_bit of the inode ('i') or data ('d') bitmap
+ * off (if used is true) or add them to the free counts of the block groups they belong
+ * to, if the image has block groups
+**/
+static void count_group_bits(unsigned char map, uint32_t first_bit, uint32_t count, bool used, fs_ctx *fs){
+	if(!has_groups(fs)) return;
+	uint32_t per_group = (map == 'd') ? A1FS_BLOCKS_PER_GROUP : fs->sb->inodes_per_group;
+	unsigned int descs_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_group_desc);
+	uint64_t end = (uint64_t)first_bit + count;
+	for(uint64_t bit = first_bit; bit < end; ){
+		uint32_t g = bit / per_group;
+		uint64_t group_end = (uint64_t)(g + 1) * per_group;
+		uint32_t n = ((end < group_end) ? end : group_end) - bit;
+		a1fs_group_desc *group = get_group(g, fs);
+		uint32_t *free_count = (map == 'd') ? &group->free_blocks_count : &group->free_inodes_count;
+		if(used) *free_count -= n;
+		else *free_count += n;
+		dirty_add(&fs->dirty_bitmaps, (uint64_t)fs->sb->group_desc + g / descs_per_block, 1);
+		bit += n;
+	}
+}
+
+/**
+ * set (if used is true) or clear bit bit_number of the inode ('i') or data ('d')
+ * bitmap, keeping the free counts in the superblock and the group descriptors in step
+**/
+static void set_bit(unsigned char map, uint32_t bit_number, bool used, fs_ctx *fs){
+	a1fs_blk_t map_start;
+	int delta = used ? -1 : 1;
+	if(map == 'd'){
+		map_start = fs->sb->data_bitmap;
+		fs->sb->free_blocks_count += delta;
+	}else{
+		map_start = fs->sb->inode_bitmap;
+		fs->sb->free_inodes_count += delta;
+	}
+	unsigned char *bitmap = get_bitmap(map, fs);
+	uint32_t byte_number = bit_number / 8;
+	int bit_number_in_byte = bit_number % 8;
+	unsigned char bitmask = (1 << (7 - bit_number_in_byte));
+	if(used) bitmap[byte_number] = bitmap[byte_number] | bitmask;
+	else bitmap[byte_number] = bitmap[byte_number] & ~bitmask;
+	mark_bitmap_dirty(map_start, bit_number, 1, fs);
+	count_group_bits(map, bit_number, 1, used, fs);
+}
+
+void allocate_bit(unsigned char map, uint32_t bit_number, fs_ctx *fs){
+	set_bit(map, bit_number, true, fs);
+	if(map == 'd'){
+		a1fs_extent block = {.start = bit_number, .count = 1};
+		freemap_take(&fs->freemap, &block);
+	}
+}
+
+void allocate_extent(a1fs_extent *extent, fs_ctx *fs){
+	unsigned char *data_bitmap = get_bitmap('d', fs);
+	bitmap_set_range(data_bitmap, extent->start, extent->count, true);
+	mark_bitmap_dirty(fs->sb->data_bitmap, extent->start, extent->count, fs);
+	fs->sb->free_blocks_count -= extent->count;
+	count_group_bits('d', extent->start, extent->count, true, fs);
+	freemap_take(&fs->freemap, extent);
+}
+
+void deallocate_bit(unsigned char map, uint32_t bit_number, fs_ctx *fs){
+	set_bit(map, bit_number, false, fs);
+	if(map == 'd'){
+		a1fs_extent block = {.start = bit_number, .count = 1};
+		freemap_give(&fs->freemap, &block);
+	}
+}
+
+void deallocate_extent(a1fs_extent *extent, fs_ctx *fs){
+	unsigned char *data_bitmap = get_bitmap('d', fs);
+	bitmap_set_range(data_bitmap, extent->start, extent->count, false);
+	mark_bitmap_dirty(fs->sb->data_bitmap, extent->start, extent->count, fs);
+	fs->sb->free_blocks_count += extent->count;
+	count_group_bits('d', extent->start, extent->count, false, fs);
+	freemap_give(&fs->freemap, extent);
+}
+
+uint64_t unreserved_blocks(fs_ctx *fs){
+	return (fs->sb->free_blocks_count > fs->map_reserved) ? fs->sb->free_blocks_count - fs->map_reserved : 0;
+}
+
+int allocate_contiguous(unsigned int count, a1fs_extent *extent, fs_ctx *fs){
+	pthread_mutex_lock(&fs->alloc_lock);
+	if(count > unreserved_blocks(fs) || freemap_search(&fs->freemap, count, extent) != 0 || extent->count < count){
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return -ENOSPC;
+	}
+	allocate_extent(extent, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	zero_blocks(extent->start, extent->count, fs);
+	return 0;
+}
+
+/**
+ * return whether block group g has both a free inode and a free data block
+**/
+static bool group_has_room(uint32_t g, fs_ctx *fs){
+	a1fs_group_desc *group = get_group(g, fs);
+	return group->free_inodes_count > 0 && group->free_blocks_count > 0;
+}
+
+/**
+ * return the block group a new inode should go in, the way ext2 picks it: a directory
+ * goes in the group with the most free blocks among those with at least the average
+ * number of free inodes, so that directories spread out over the image; a file goes
+ * in the group of its parent directory, or else in a group with room found by hashing
+ * from there; failing both, any group with a free inode
+ * NOTE: must be called with fs->alloc_lock held, and there must be a free inode
+**/
+static uint32_t pick_inode_group(a1fs_inode *parent, bool dir, fs_ctx *fs){
+	uint32_t groups = fs->sb->groups_count;
+	uint32_t parent_group = parent->inode_number / fs->sb->inodes_per_group;
+	if(dir){
+		uint32_t average = fs->sb->free_inodes_count / groups;
+		int best = -1;
+		for(uint32_t g = 0; g < groups; g++){
+			a1fs_group_desc *group = get_group(g, fs);
+			if(group->free_inodes_count == 0 || group->free_inodes_count < average) continue;
+			if(best == -1 || group->free_blocks_count > get_group(best, fs)->free_blocks_count) best = g;
+		}
+		if(best != -1) return best;
+	}else{
+		if(group_has_room(parent_group, fs)) return parent_group;
+		uint32_t g = parent_group;
+		for(uint32_t step = 1; step < groups; step <<= 1){
+			g = (g + step) % groups;
+			if(group_has_room(g, fs)) return g;
+		}
+	}
+	for(uint32_t i = 0; i < groups; i++){
+		uint32_t g = (parent_group + i) % groups;
+		if(get_group(g, fs)->free_inodes_count > 0) return g;
+	}
+	return parent_group;
+}
+
+int allocate_inode(a1fs_ino_t *inode_number, a1fs_inode *parent, bool dir, fs_ctx *fs){
+    unsigned char *inode_bitmap = get_bitmap('i', fs);
+	a1fs_extent extent;
+
+	pthread_mutex_lock(&fs->alloc_lock);
+	bool found = false;
+	if(has_groups(fs) && fs->sb->free_inodes_count > 0){
+		//the group's inodes are a run of bits of the inode bitmap
+		uint32_t first = pick_inode_group(parent, dir, fs) * fs->sb->inodes_per_group;
+		uint32_t end = first + fs->sb->inodes_per_group;
+		extent.start = bitmap_find_next(inode_bitmap, end, first, false);
+		found = (extent.start < end);
+	}
+	if(!found && search_bitmap(inode_bitmap, fs->sb->inodes_count, 1, &extent) != 0){
+		pthread_mutex_unlock(&fs->alloc_lock);
+		return -ENOSPC;
+	}
+
+	*inode_number = extent.start;
+
+	allocate_bit('i', *inode_number, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+
+	return 0;
+
+}
+
+/**
+ * return the number of the block of the file represented by inode after its last extent
+**/
+static uint64_t end_block(a1fs_inode *inode, fs_ctx *fs){
+	int count = count_extents(inode, fs);
+	if(count == 0) return 0;
+	a1fs_extent *last_extent = get_extent(inode, count - 1, fs);
+	return (uint64_t)last_extent->lblk + last_extent->count;
+}
+
+/**
+ * merge each extent of inode from first to last (inclusive) into the extent before
+ * it if both have the same flags and continue each other on disk and in the file
+**/
+static void merge_extents(a1fs_inode *inode, int first, int last, fs_ctx *fs){
+	if(first < 1) first = 1;
+	for(int i = first; i <= last && i < count_extents(inode, fs); ){
+		a1fs_extent *prev = get_extent(inode, i - 1, fs);
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		if(prev->flags == extent->flags && prev->start + prev->count == extent->start &&
+		   (uint64_t)prev->lblk + prev->count == extent->lblk){
+			prev->count += extent->count;
+			remove_extents(inode, i, 1, fs);
+			last--;
+		}else{
+			i++;
+		}
+	}
+}
+
+/**
+ * return the number of blocks among blocks lblk to lblk + count - 1 of the file
+ * represented by inode that are not allocated
+**/
+static uint64_t count_holes(a1fs_inode *inode, uint64_t lblk, uint64_t count, fs_ctx *fs){
+	uint64_t end = lblk + count;
+	uint64_t holes = count;
+	int num_extents = count_extents(inode, fs);
+	int i = find_extent(inode, lblk, fs);
+	if(i == -1) i = find_extent_after(inode, lblk, fs);
+	for(; i < num_extents; i++){
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		if(extent->lblk >= end) break;
+		uint64_t from = (extent->lblk > lblk) ? extent->lblk : lblk;
+		uint64_t to = (uint64_t)extent->lblk + extent->count;
+		if(to > end) to = end;
+		holes -= to - from;
+	}
+	return holes;
+}
+
+/**
+ * give the data blocks of extent back to the data bitmap
+**/
+static void free_data_blocks(a1fs_extent *extent, fs_ctx *fs){
+	pthread_mutex_lock(&fs->alloc_lock);
+	deallocate_extent(extent, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+}
+
+void deallocate_range(a1fs_inode *inode, uint64_t lblk, uint64_t count, fs_ctx *fs){
+	uint64_t end = (count > UINT64_MAX - lblk) ? UINT64_MAX : lblk + count;
+
+	int i = find_extent(inode, lblk, fs);
+	if(i == -1) i = find_extent_after(inode, lblk, fs);
+	while(i < count_extents(inode, fs)){
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		if(extent->lblk >= end) break;
+		uint64_t extent_end = (uint64_t)extent->lblk + extent->count;
+		uint64_t cut_start = (lblk > extent->lblk) ? lblk : extent->lblk;
+		uint64_t cut_end = (end < extent_end) ? end : extent_end;
+		a1fs_extent cut = {.start = extent->start + (cut_start - extent->lblk),
+		                   .count = cut_end - cut_start};
+
+		if(cut_start == extent->lblk && cut_end == extent_end){
+			//the whole extent goes
+			free_data_blocks(extent, fs);
+			inode->blocks -= extent->count;
+			remove_extents(inode, i, 1, fs);
+			continue;
+		}
+		if(cut_start == extent->lblk){
+			free_data_blocks(&cut, fs);
+			inode->blocks -= cut.count;
+			extent->start += cut.count;
+			extent->lblk += cut.count;
+			extent->count -= cut.count;
+		}else if(cut_end == extent_end){
+			free_data_blocks(&cut, fs);
+			inode->blocks -= cut.count;
+			extent->count -= cut.count;
+		}else if(insert_extents(inode, i + 1, &(a1fs_extent){cut.start + cut.count, extent_end - cut_end,
+		                                                    cut_end, extent->flags}, 1, fs)){
+			//split the extent around the freed blocks
+			extent = get_extent(inode, i, fs);
+			extent->count = cut_start - extent->lblk;
+			free_data_blocks(&cut, fs);
+			inode->blocks -= cut.count;
+			i++;
+		}else if(!(extent->flags & A1FS_EXTENT_UNWRITTEN)){
+			//no room to split; keep the blocks but make them read as zeros
+			zero_blocks(cut.start, cut.count, fs);
+			mark_dirty(inode, cut.start, cut.count, fs);
+		}
+		i++;
+	}
+}
+
+/**
+ * the blocks taken in a hole run from its start (or from the end of the extent before
+ * it), so each hole the range had adds at most one range of file blocks to taken
+ * fs->alloc_lock is only held to search and take free blocks; the extent map belongs
+ * to the inode, whose lock the caller holds
+**/
+int allocate_range(a1fs_inode *inode, uint64_t lblk, uint64_t count, uint32_t flags, fs_ctx *fs){
+	a1fs_extent extent;
+
+	//don't take part of the free space only to fail
+	//(and the extent block, unless the extents can go in the inode)
+	bool new_map = (inode->extents == -1 && inline_capacity(fs) < sizeof(a1fs_extent));
+	uint64_t needed = count_holes(inode, lblk, count, fs) + new_map;
+	pthread_mutex_lock(&fs->alloc_lock);
+	bool enough = (needed <= unreserved_blocks(fs));
+	pthread_mutex_unlock(&fs->alloc_lock);
+	if(!enough) return -ENOSPC;
+
+	uint64_t pos = lblk;
+	uint64_t end = lblk + count;
+	int max_taken = count_extents_before(inode, end, fs) - count_extents_before(inode, lblk, fs) + 2;
+	a1fs_extent *taken = malloc(max_taken * sizeof(a1fs_extent));
+	if(taken == NULL) return -ENOMEM;
+	int num_taken = 0;
+	int error = 0;
+	while(pos < end){
+		int i = find_extent(inode, pos, fs);
+		if(i != -1){
+			//already allocated
+			a1fs_extent *extent = get_extent(inode, i, fs);
+			pos = (uint64_t)extent->lblk + extent->count;
+			continue;
+		}
+
+		//the hole may need another extent
+		bool room = make_extent_room(inode, 1, fs);
+
+		//the hole at pos ends at the next extent
+		int next = find_extent_after(inode, pos, fs);
+		uint64_t hole_end = (next < count_extents(inode, fs)) ? get_extent(inode, next, fs)->lblk : end;
+		if(hole_end > end) hole_end = end;
+		a1fs_extent *prev = (next > 0) ? get_extent(inode, next - 1, fs) : NULL;
+
+		//out of extent slots: fill the hole from the end of the previous extent so that
+		//it can grow instead; the file loses the hole but not the write
+		bool fill = (!room && prev != NULL);
+		if(fill) pos = (uint64_t)prev->lblk + prev->count;
+
+		pthread_mutex_lock(&fs->alloc_lock);
+		//the blocks set aside for extent maps to grow into are not for data
+		uint64_t length = hole_end - pos;
+		if(length > unreserved_blocks(fs)) length = unreserved_blocks(fs);
+		if(length == 0){
+			error = -ENOSPC;
+		}else if(prev != NULL){
+			//place the blocks where they would be had the file been written without
+			//holes after its previous extent, so that it can grow in place
+			error = freemap_search_goal(&fs->freemap, prev->start + (pos - prev->lblk), length,
+			                            A1FS_ALLOC_GROWTH_ROOM, &extent);
+		}else if(has_groups(fs)){
+			//start the file in the first free blocks of the group of its inode, as
+			//freemap_search() would in the whole image
+			error = freemap_search_goal(&fs->freemap, inode_goal(inode, fs), length, 0, &extent);
+		}else{
+			error = freemap_search(&fs->freemap, length, &extent);
+		}
+		bool grow_prev = (error == 0 && prev != NULL && (uint64_t)prev->lblk + prev->count == pos &&
+		                  prev->start + prev->count == extent.start && (prev->flags == flags || fill));
+		if(error == 0 && !grow_prev && !room) error = -ENOSPC;
+		if(error == 0) allocate_extent(&extent, fs);
+		pthread_mutex_unlock(&fs->alloc_lock);
+		if(error != 0) break;
+
+		inode->blocks += extent.count;
+		if(grow_prev){
+			if(prev->flags != flags && !(prev->flags & A1FS_EXTENT_UNWRITTEN)){
+				zero_blocks(extent.start, extent.count, fs);
+				mark_dirty(inode, extent.start, extent.count, fs);
+			}
+			prev->count += extent.count;
+		}else{
+			extent.lblk = pos;
+			extent.flags = flags;
+			//the data may have taken the blocks the extent map was to grow into
+			if(!insert_extents(inode, next, &extent, 1, fs)){
+				free_data_blocks(&extent, fs);
+				inode->blocks -= extent.count;
+				error = -ENOSPC;
+				break;
+			}
+		}
+		if(num_taken > 0 && (uint64_t)taken[num_taken - 1].lblk + taken[num_taken - 1].count == pos){
+			taken[num_taken - 1].count += extent.count;
+		}else{
+			taken[num_taken++] = (a1fs_extent){.count = extent.count, .lblk = pos};
+		}
+		pos += extent.count;
+		//the new blocks may continue into the following extent
+		merge_extents(inode, next, next + 1, fs);
+	}
+	//the room made for an extent that went into the previous one instead
+	release_extent_room(inode, fs);
+
+	//give back what was taken rather than leave the file with blocks the caller
+	//did not get, e.g. past the end of the file after a failed write
+	if(error != 0){
+		for(int k = num_taken - 1; k >= 0; k--){
+			deallocate_range(inode, taken[k].lblk, taken[k].count, fs);
+		}
+	}
+	free(taken);
+	return error;
+}
+
+int allocate_blocks(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs){
+	//file data is only stored once written; directories write their blocks right away
+	uint32_t flags = S_ISDIR(inode->mode) ? 0 : A1FS_EXTENT_UNWRITTEN;
+	return allocate_range(inode, end_block(inode, fs), num_blocks, flags, fs);
+}
+
+void mark_written(a1fs_inode *inode, int i, uint64_t block_index, uint64_t count, fs_ctx *fs){
+	//only this file's extent map changes; make_extent_room() and the map take
+	//fs->alloc_lock themselves for the blocks the map grows into or gives back
+	a1fs_extent extent = *get_extent(inode, i, fs);
+	a1fs_blk_t head = block_index - extent.lblk;
+	a1fs_blk_t tail = extent.lblk + extent.count - block_index - count;
+	int pieces = 1 + (head > 0) + (tail > 0);
+
+	if(!make_extent_room(inode, pieces - 1, fs)){
+		//no room to split the extent; zero the rest of it and write it as a whole
+		zero_blocks(extent.start, head, fs);
+		zero_blocks(extent.start + extent.count - tail, tail, fs);
+		mark_dirty(inode, extent.start, extent.count, fs);
+		get_extent(inode, i, fs)->flags &= ~A1FS_EXTENT_UNWRITTEN;
+		merge_extents(inode, i, i + 1, fs);
+		return;
+	}
+
+	//replace the extent with its unwritten head, the written blocks and its unwritten tail
+	a1fs_extent split[3];
+	int n = 0;
+	if(head > 0){
+		split[n++] = (a1fs_extent){extent.start, head, extent.lblk, extent.flags};
+	}
+	split[n++] = (a1fs_extent){extent.start + head, count, block_index, extent.flags & ~A1FS_EXTENT_UNWRITTEN};
+	if(tail > 0){
+		split[n++] = (a1fs_extent){extent.start + head + count, tail, block_index + count, extent.flags};
+	}
+	insert_extents(inode, i + 1, &split[1], pieces - 1, fs);
+	*get_extent(inode, i, fs) = split[0];
+	merge_extents(inode, i, i + pieces, fs);
+}
+
+void deallocate_inode(a1fs_inode *inode, fs_ctx *fs){
+	pthread_mutex_lock(&fs->alloc_lock);
+	//deallocate the data blocks of all extents
+	int count = count_extents(inode, fs);
+	for(int i = 0; i < count; i++){
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		deallocate_extent(extent, fs);
+		inode->blocks -= extent->count;
+	}
+	if(inode->dir_index_blocks > 0){
+		a1fs_extent index = {.start = inode->dir_index, .count = inode->dir_index_blocks};
+		deallocate_extent(&index, fs);
+	}
+	pthread_mutex_unlock(&fs->alloc_lock);
+
+	//release the blocks holding the extents themselves (this takes the lock per block),
+	//and only then the inode number
+	free_extent_map(inode, fs);
+	pthread_mutex_lock(&fs->alloc_lock);
+	deallocate_bit('i', inode->inode_number, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+
+	//the blocks are no longer the file's to write back
+	dirty_clear(&fs->dirty[inode->inode_number]);
+}
+
+void deallocate_blocks(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs){
+	uint64_t end = end_block(inode, fs);
+	deallocate_range(inode, end - num_blocks, num_blocks, fs);
+}
@@ -0,0 +1,161 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Inode and data block allocation header file.
+ */
+
+#pragma once
+
+#include "a1fs.h"
+#include "bitmap.h"
+#include "fs_ctx.h"
+
+
+/**
+ * Number of free blocks a file that cannot grow in place prefers to find after
+ * its new blocks, so that its following appends can extend the same extent.
+ */
+#define A1FS_ALLOC_GROWTH_ROOM 16
+
+//NOTE: the functions that only flip bits (allocate_bit(), deallocate_bit(),
+// allocate_extent(), deallocate_extent()) and search_bitmap() must be called
+// with fs->alloc_lock held; the rest take it themselves, only while they search
+// and take or give back blocks. The extent map of a file is protected by the
+// inode lock instead, so files are changed in parallel. Data bitmap changes
+// are mirrored in fs->freemap, which is what free blocks are searched in, and
+// the changed bitmap blocks are recorded in fs->dirty_bitmaps for fsync.
+
+/**
+ * return the number of free data blocks not set aside by make_extent_room() for extent
+ * maps to grow into; data is only ever given these
+ * NOTE: must be called with fs->alloc_lock held
+**/
+uint64_t unreserved_blocks(fs_ctx *fs);
+
+/**
+ * switch bit bit_number to a 1 in bitmap
+**/
+void allocate_bit(unsigned char map, uint32_t bit_number, fs_ctx *fs);
+
+/**
+ * switch all bits from extent start to extent start + extent count to 1
+ * NOTE: assumed we are allocating to the data bitmap
+**/
+void allocate_extent(a1fs_extent *extent, fs_ctx *fs);
+
+/**
+ * switch bit bit_number to a 0 in bitmap
+**/
+void deallocate_bit(unsigned char map, uint32_t bit_number, fs_ctx *fs);
+
+/**
+ * switch all bits from extent start to extent start + extent count to 0
+ * NOTE: assumed we are deallocating from the data bitmap
+**/
+void deallocate_extent(a1fs_extent *extent, fs_ctx *fs);
+
+/**
+ * allocate a run of count contiguous zeroed data blocks, not owned by any extent map
+ * 
+ * @param count   number of blocks needed
+ * @param extent  extent struct to populate with the allocated run
+ * @param fs      file system context
+ * @return        0 on success, -ENOSPC if there is no free run that long
+**/
+int allocate_contiguous(unsigned int count, a1fs_extent *extent, fs_ctx *fs);
+
+/**
+ * Traverses the inode_bitmap and allocate the first available inode
+ * with block groups, the inode goes in its parent's group if it is a file, and in a
+ * group with more free space than most if it is a directory
+ * return 0 on success, return -1 on error
+ * 
+ * @param fs 			file system context
+ * @param inode_number 	index of free inode found, -1 if not found
+ * @param parent 		the directory the new inode is created in
+ * @param dir 			whether the new inode is a directory
+ * @return int 0 on success, -1 on error
+ */
+int allocate_inode(a1fs_ino_t *inode_number, a1fs_inode *parent, bool dir, fs_ctx *fs);
+
+/**
+ * allocate data blocks for the holes among blocks lblk to lblk + count - 1 of the file
+ * represented by inode; blocks of the range that are already allocated are kept
+ * each hole is placed right after the blocks of the extent before it when free, so that
+ * extent grows instead of a new extent being added; new extents get the given flags
+ * (A1FS_EXTENT_UNWRITTEN for blocks that are not zeroed)
+ * fails without allocating anything if there are fewer free blocks than holes; if it runs
+ * out of extents instead, the blocks allocated until then are given back
+ * NOTE: the caller must hold the inode lock for writing
+ *
+ * @param inode  pointer to inode of the file
+ * @param lblk   first block of the file to allocate
+ * @param count  number of blocks of the file to allocate
+ * @param flags  flags of the new extents
+ * @param fs     file system context
+ * @return       0 on success, -ENOSPC if out of data blocks or extents,
+ *               -ENOMEM if out of memory
+**/
+int allocate_range(a1fs_inode *inode, uint64_t lblk, uint64_t count, uint32_t flags, fs_ctx *fs);
+
+/**
+ * deallocate the data blocks of the file represented by inode among blocks lblk to
+ * lblk + count - 1 of the file, leaving a hole; an extent that the range cuts in the
+ * middle is split, or if there is no room for another extent has the blocks zeroed instead
+ * NOTE: the caller must hold the inode lock for writing
+**/
+void deallocate_range(a1fs_inode *inode, uint64_t lblk, uint64_t count, fs_ctx *fs);
+
+/**
+ * Allocate num_blocks data blocks to inode pointed to by inode, after its last extent
+ * the blocks are taken right after the file's last block when free, in which
+ * case the last extent grows instead of a new extent being added
+ * the new blocks of a regular file are not zeroed; they are added as unwritten
+ * (A1FS_EXTENT_UNWRITTEN) and read as zeros until written
+ * NOTE: the caller must hold the inode lock for writing
+ * 
+ * @param inode      pointer to inode to allocate space for
+ * @param num_bytes  number of bytes to allocate
+ * @param fs         file system context
+ * @return           0 on success, -ENOSPC if not enough space available,
+ *                   -ENOMEM if out of memory
+**/
+int allocate_blocks(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs);
+
+/**
+ * mark count blocks of inode starting at block block_index of the file, which must all
+ * lie in the unwritten extent at index i, as written; the written part is split off
+ * the extent and merged with a written neighbour it continues
+ * if there is no room to split the extent, the rest of it is zeroed and the whole
+ * extent is marked written
+ * NOTE: the caller must hold the inode lock for writing, and must store (or zero)
+ * all of the data of the blocks before the file is read again
+**/
+void mark_written(a1fs_inode *inode, int i, uint64_t block_index, uint64_t count, fs_ctx *fs);
+
+/**
+ * deallocate all data blocks pointed to by the inodes extents
+ * change inode bitmap at index of the inode's number to 0
+ * 
+ * @param inode  the inode to deallocate
+ * @param fs     file system context
+**/
+void deallocate_inode(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * deallocate the last num_blocks data blocks of the file represented by inode
+ * NOTE: the caller must hold the inode lock for writing
+**/
+void deallocate_blocks(a1fs_inode *inode, uint64_t num_blocks, fs_ctx *fs);
@@ -0,0 +1,608 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block device backend implementation (pread backend).
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "bdev.h"
+#include "map.h"
+
+
+// The cache holds blocks in frames. A frame in use by some thread (pinned) is
+// never evicted; the others are evicted in CLOCK order: the clock hand sweeps
+// over the frames, gives each recently used frame a second chance by clearing
+// its reference bit, and evicts the first frame that has not been used since
+// the hand last passed it, writing it back first if it is modified.
+//
+// The lock is not held during I/O, so that a miss does not hold up the threads
+// that hit the cache. A block being read is in the hash table from the start,
+// marked as loading, and other threads that want it wait for the read to end.
+// A frame being written back is marked as busy, which keeps it from being
+// evicted or written back by another thread meanwhile; threads that get it wait
+// as well, so that it is not changed while a victim is being written.
+//
+// A thread's pins are kept in a per-thread list, so that bdev_release() can
+// give them all back at once.
+//
+// I/O errors and running out of memory while getting a block are fatal, since
+// the callers (like those of the mmap backend, where they would raise SIGBUS)
+// have no way to handle them.
+
+/** Maximum number of ranges given to bdev_map(). */
+#define BCACHE_REGIONS 4
+
+/** A cache frame holding one block. */
+typedef struct frame {
+	/** Block number; valid if the frame is in the hash table. */
+	uint64_t block;
+	/** Block contents. */
+	void *data;
+	/** Number of uses by bdev_get() not given back yet (by all threads). */
+	unsigned int pins;
+	/** CLOCK reference bit: the frame has been used since the hand passed it. */
+	bool ref;
+	/** The block was modified since it was last written back. */
+	bool dirty;
+	/** The frame holds a block (and is in the hash table). */
+	bool valid;
+	/** The block is being read into the frame; its contents are not valid yet. */
+	bool loading;
+	/** The block is being written back with the lock dropped. */
+	bool busy;
+	/** Next frame in the same hash bucket. */
+	struct frame *next;
+
+} frame;
+
+/** A resident range of blocks given to bdev_map(). */
+typedef struct region {
+	uint64_t block;
+	uint64_t count;
+	void *data;
+
+} region;
+
+/** Blocks in use by one thread. */
+typedef struct pin_list {
+	/** Device the blocks belong to. */
+	bdev *dev;
+	frame **frames;
+	size_t count;
+	size_t capacity;
+	/** bdev_writing() was called since the last bdev_release(). */
+	bool writing;
+
+} pin_list;
+
+typedef struct bcache {
+	/** Protects the frames and the hash table, but not the block contents. */
+	pthread_mutex_t lock;
+	/** Signalled when a frame stops loading or being busy. */
+	pthread_cond_t io_done;
+	/** Number of frames to keep when they are not all in use. */
+	size_t capacity;
+	/** All frames in CLOCK order. */
+	frame **frames;
+	size_t num_frames;
+	size_t frames_size;
+	/** Position of the clock hand in frames. */
+	size_t hand;
+	/** Hash table of valid frames by block number; num_buckets is a power of 2. */
+	frame **buckets;
+	size_t num_buckets;
+	/** Ranges given to bdev_map(); only changed while the device is opened. */
+	region regions[BCACHE_REGIONS];
+	int num_regions;
+	/** Per-thread pin_list. */
+	pthread_key_t pins_key;
+
+} bcache;
+
+
+/** Terminate after an error the caller of bdev_get() could not handle. */
+static void fatal(const char *what)
+{
+	perror(what);
+	abort();
+}
+
+static int read_full(int fd, void *buf, size_t size, off_t pos)
+{
+	while (size > 0) {
+		ssize_t n = pread(fd, buf, size, pos);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return (n < 0) ? -errno : -EIO;
+		buf = (char *)buf + n;
+		size -= n;
+		pos += n;
+	}
+	return 0;
+}
+
+static int write_full(int fd, const void *buf, size_t size, off_t pos)
+{
+	while (size > 0) {
+		ssize_t n = pwrite(fd, buf, size, pos);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return (n < 0) ? -errno : -EIO;
+		buf = (const char *)buf + n;
+		size -= n;
+		pos += n;
+	}
+	return 0;
+}
+
+static off_t block_pos(uint64_t block)
+{
+	return (off_t)block * A1FS_BLOCK_SIZE;
+}
+
+
+static region *find_region(bcache *c, uint64_t block)
+{
+	for (int i = 0; i < c->num_regions; i++) {
+		region *r = &c->regions[i];
+		if ((block >= r->block) && (block - r->block < r->count)) return r;
+	}
+	return NULL;
+}
+
+static frame **bucket(bcache *c, uint64_t block)
+{
+	// Fibonacci hashing spreads out runs of consecutive block numbers
+	return &c->buckets[(block * 0x9e3779b97f4a7c15ULL) >> 32 & (c->num_buckets - 1)];
+}
+
+static frame *lookup(bcache *c, uint64_t block)
+{
+	for (frame *f = *bucket(c, block); f != NULL; f = f->next) {
+		if (f->block == block) return f;
+	}
+	return NULL;
+}
+
+static void unhash(bcache *c, frame *f)
+{
+	frame **p = bucket(c, f->block);
+	while (*p != f) p = &(*p)->next;
+	*p = f->next;
+	f->valid = false;
+}
+
+// Write a modified frame back to the image file. The cache lock is dropped
+// during the write, so the caller must check the frame again afterwards.
+static int write_frame(bdev *dev, frame *f)
+{
+	bcache *c = dev->cache;
+	assert(f->valid && !f->loading && !f->busy);
+	// Cleared first, so that a change made during the write marks it again
+	f->dirty = false;
+	f->busy = true;
+	pthread_mutex_unlock(&c->lock);
+	int ret = write_full(dev->fd, f->data, A1FS_BLOCK_SIZE, block_pos(f->block));
+	pthread_mutex_lock(&c->lock);
+	f->busy = false;
+	if (ret != 0) f->dirty = true;
+	pthread_cond_broadcast(&c->io_done);
+	return ret;
+}
+
+// Wait until no frame of a block is loading or busy; returns its frame if any
+static frame *lookup_idle(bcache *c, uint64_t block)
+{
+	frame *f;
+	while (((f = lookup(c, block)) != NULL) && (f->loading || f->busy)) {
+		pthread_cond_wait(&c->io_done, &c->lock);
+	}
+	return f;
+}
+
+static frame *new_frame(bcache *c)
+{
+	if (c->num_frames == c->frames_size) {
+		size_t size = c->frames_size * 2;
+		frame **frames = realloc(c->frames, size * sizeof(frame *));
+		if (frames == NULL) return NULL;
+		c->frames = frames;
+		c->frames_size = size;
+	}
+
+	frame *f = calloc(1, sizeof(frame));
+	if (f == NULL) return NULL;
+	f->data = aligned_alloc(A1FS_BLOCK_SIZE, A1FS_BLOCK_SIZE);
+	if (f->data == NULL) {
+		free(f);
+		return NULL;
+	}
+	c->frames[c->num_frames++] = f;
+	return f;
+}
+
+// Free an unused frame that holds no block, shrinking the cache
+static void free_frame(bcache *c, frame *f)
+{
+	size_t i = 0;
+	while (c->frames[i] != f) i++;
+	c->frames[i] = c->frames[--c->num_frames];
+	if (c->hand >= c->num_frames) c->hand = 0;
+	free(f->data);
+	free(f);
+}
+
+// Find a frame for a new block: a new one while there are fewer than capacity,
+// else the next one the clock hand evicts, else (all frames are in use) a new one.
+// The returned frame holds no block. The lock may be dropped to write back
+// modified frames on the way.
+static frame *victim(bdev *dev)
+{
+	bcache *c = dev->cache;
+	// Two rounds clear all reference bits
+	for (size_t n = 0; (c->num_frames >= c->capacity) && (n < 2 * c->num_frames); n++) {
+		frame *f = c->frames[c->hand];
+		c->hand = (c->hand + 1) % c->num_frames;
+		if ((f->pins > 0) || f->busy) continue;
+		if (f->ref) {
+			f->ref = false;
+			continue;
+		}
+		if (f->valid && f->dirty) {
+			if (write_frame(dev, f) != 0) {
+				perror("a1fs: block write back failed");
+				continue;
+			}
+			// Another thread may have used it while the lock was dropped
+			if ((f->pins > 0) || f->dirty) continue;
+		}
+		if (f->valid) unhash(c, f);
+		// Frames added while all were in use are given back here if modified
+		if (c->num_frames > c->capacity) {
+			free_frame(c, f);
+			continue;
+		}
+		return f;
+	}
+	return new_frame(c);
+}
+
+// Give back one use of a frame; the caller must hold the cache lock
+static void unpin(bdev *dev, frame *f, bool writing)
+{
+	bcache *c = dev->cache;
+	if (writing) f->dirty = true;
+	assert((f->pins > 0) && !f->loading);
+	// A modified frame is written back (without the lock) by victim() instead
+	if ((--f->pins == 0) && (c->num_frames > c->capacity) && !f->dirty && !f->busy) {
+		if (f->valid) unhash(c, f);
+		free_frame(c, f);
+	}
+}
+
+
+// Destructor of a thread's pin list, called when the thread exits
+static void free_pins(void *data)
+{
+	pin_list *pl = (pin_list*)data;
+	if (pl->count > 0) {
+		bcache *c = pl->dev->cache;
+		pthread_mutex_lock(&c->lock);
+		for (size_t i = 0; i < pl->count; i++) unpin(pl->dev, pl->frames[i], pl->writing);
+		pthread_mutex_unlock(&c->lock);
+	}
+	free(pl->frames);
+	free(pl);
+}
+
+static pin_list *get_pins(bdev *dev)
+{
+	bcache *c = dev->cache;
+	pin_list *pl = pthread_getspecific(c->pins_key);
+	if (pl != NULL) return pl;
+
+	pl = calloc(1, sizeof(pin_list));
+	if (pl == NULL) fatal("a1fs: pin list");
+	pl->dev = dev;
+	if (pthread_setspecific(c->pins_key, pl) != 0) fatal("a1fs: pin list");
+	return pl;
+}
+
+static void add_pin(pin_list *pl, frame *f)
+{
+	if (pl->count == pl->capacity) {
+		size_t capacity = (pl->capacity == 0) ? 16 : 2 * pl->capacity;
+		frame **frames = realloc(pl->frames, capacity * sizeof(frame *));
+		if (frames == NULL) fatal("a1fs: pin list");
+		pl->frames = frames;
+		pl->capacity = capacity;
+	}
+	pl->frames[pl->count++] = f;
+}
+
+
+// Read a block into a new frame pinned for the caller, with the lock dropped
+// during the read. The frame is in the hash table (loading) from the start, so
+// that other threads that want the block wait for it rather than read it again.
+static frame *load(bdev *dev, uint64_t block)
+{
+	bcache *c = dev->cache;
+	frame *f = victim(dev);
+	if (f == NULL) fatal("a1fs: block cache");
+	// Another thread may have got the block while victim() dropped the lock;
+	// the unused frame is then left for the next victim()
+	frame *other = lookup(c, block);
+	if (other != NULL) {
+		if (c->num_frames > c->capacity) free_frame(c, f);
+		other->pins++;
+		return other;
+	}
+
+	f->block = block;
+	f->pins = 1;
+	f->dirty = false;
+	f->valid = true;
+	f->loading = true;
+	frame **b = bucket(c, block);
+	f->next = *b;
+	*b = f;
+	pthread_mutex_unlock(&c->lock);
+
+	int ret = read_full(dev->fd, f->data, A1FS_BLOCK_SIZE, block_pos(block));
+	if (ret != 0) {
+		errno = -ret;
+		fatal("a1fs: block read");
+	}
+
+	pthread_mutex_lock(&c->lock);
+	f->loading = false;
+	pthread_cond_broadcast(&c->io_done);
+	return f;
+}
+
+static void *cache_get(bdev *dev, uint64_t block)
+{
+	bcache *c = dev->cache;
+	region *r = find_region(c, block);
+	if (r != NULL) return (char *)r->data + (block - r->block) * A1FS_BLOCK_SIZE;
+
+	pin_list *pl = get_pins(dev);
+	pthread_mutex_lock(&c->lock);
+	frame *f = lookup(c, block);
+	if (f != NULL) {
+		f->pins++;
+	} else {
+		f = load(dev, block);
+	}
+	// Another thread may still be reading or writing back the block
+	while (f->loading || f->busy) pthread_cond_wait(&c->io_done, &c->lock);
+	f->ref = true;
+	if (pl->writing) f->dirty = true;
+	pthread_mutex_unlock(&c->lock);
+
+	add_pin(pl, f);
+	return f->data;
+}
+
+static void cache_put(bdev *dev, const void *addr)
+{
+	bcache *c = dev->cache;
+	pin_list *pl = get_pins(dev);
+	// The most recently got blocks are the most likely to be put
+	for (size_t i = pl->count; i-- > 0;) {
+		frame *f = pl->frames[i];
+		if (((const char *)addr >= (char *)f->data) &&
+		    ((const char *)addr < (char *)f->data + A1FS_BLOCK_SIZE))
+		{
+			pl->frames[i] = pl->frames[--pl->count];
+			pthread_mutex_lock(&c->lock);
+			unpin(dev, f, pl->writing);
+			pthread_mutex_unlock(&c->lock);
+			return;
+		}
+	}
+	// Not a pinned frame, i.e. a block of a region
+}
+
+static void cache_release(bdev *dev)
+{
+	bcache *c = dev->cache;
+	pin_list *pl = get_pins(dev);
+	pthread_mutex_lock(&c->lock);
+	for (size_t i = 0; i < pl->count; i++) unpin(dev, pl->frames[i], pl->writing);
+	pthread_mutex_unlock(&c->lock);
+	pl->count = 0;
+	pl->writing = false;
+}
+
+static void cache_writing(bdev *dev)
+{
+	bcache *c = dev->cache;
+	pin_list *pl = get_pins(dev);
+	if (pl->writing) return;
+	pl->writing = true;
+	pthread_mutex_lock(&c->lock);
+	for (size_t i = 0; i < pl->count; i++) pl->frames[i]->dirty = true;
+	pthread_mutex_unlock(&c->lock);
+}
+
+// Write back the part of region r within count blocks starting at block
+static int write_region(bdev *dev, region *r, uint64_t block, uint64_t count)
+{
+	uint64_t start = (block > r->block) ? block : r->block;
+	uint64_t end = (block + count < r->block + r->count) ? block + count : r->block + r->count;
+	if (start >= end) return 0;
+	return write_full(dev->fd, (char *)r->data + (start - r->block) * A1FS_BLOCK_SIZE,
+	                  (end - start) * A1FS_BLOCK_SIZE, block_pos(start));
+}
+
+static int cache_writeback(bdev *dev, uint64_t block, uint64_t count)
+{
+	bcache *c = dev->cache;
+	int ret = 0;
+	for (int i = 0; (i < c->num_regions) && (ret == 0); i++) {
+		ret = write_region(dev, &c->regions[i], block, count);
+	}
+
+	// A busy frame is waited for, since its write may have started before the
+	// changes to be written back were made
+	pthread_mutex_lock(&c->lock);
+	if (count <= c->num_frames) {
+		for (uint64_t b = block; (b < block + count) && (ret == 0); b++) {
+			frame *f = lookup_idle(c, b);
+			if ((f != NULL) && f->dirty) ret = write_frame(dev, f);
+		}
+	} else {
+		// Fewer frames than blocks to look up. Going from the end, the frames
+		// not seen yet stay ahead when free_frame() moves the last one while
+		// the lock is dropped.
+		for (size_t i = c->num_frames; (i-- > 0) && (ret == 0);) {
+			if (i >= c->num_frames) continue;
+			frame *f = c->frames[i];
+			if (!f->valid || (f->block < block) || (f->block - block >= count)) continue;
+			if (f->busy) {
+				pthread_cond_wait(&c->io_done, &c->lock);
+				i++;
+			} else if (f->dirty) {
+				ret = write_frame(dev, f);
+			}
+		}
+	}
+	pthread_mutex_unlock(&c->lock);
+	return ret;
+}
+
+static int cache_flush(bdev *dev)
+{
+	return (fdatasync(dev->fd) != 0) ? -errno : 0;
+}
+
+// Have the kernel read the blocks into its page cache, so that the pread()
+// that fills their frames later does not wait for the disk
+static void cache_prefetch(bdev *dev, uint64_t block, uint64_t count)
+{
+	posix_fadvise(dev->fd, block_pos(block), count * A1FS_BLOCK_SIZE, POSIX_FADV_WILLNEED);
+}
+
+static void *cache_map(bdev *dev, uint64_t block, uint64_t count)
+{
+	bcache *c = dev->cache;
+	if (c->num_regions == BCACHE_REGIONS) return NULL;
+
+	// The range takes over from any frames of its blocks
+	pthread_mutex_lock(&c->lock);
+	for (uint64_t b = block; b < block + count; b++) {
+		frame *f = lookup_idle(c, b);
+		if ((f != NULL) && f->dirty && (write_frame(dev, f) != 0)) {
+			perror("a1fs: block write back failed");
+			pthread_mutex_unlock(&c->lock);
+			return NULL;
+		}
+		if (f != NULL) unhash(c, f);
+	}
+	pthread_mutex_unlock(&c->lock);
+
+	void *data = aligned_alloc(A1FS_BLOCK_SIZE, count * A1FS_BLOCK_SIZE);
+	if (data == NULL) return NULL;
+	if (read_full(dev->fd, data, count * A1FS_BLOCK_SIZE, block_pos(block)) != 0) {
+		free(data);
+		return NULL;
+	}
+	c->regions[c->num_regions++] = (region){ block, count, data };
+	return data;
+}
+
+static void cache_close(bdev *dev)
+{
+	bcache *c = dev->cache;
+	if (cache_writeback(dev, 0, dev->size / A1FS_BLOCK_SIZE) != 0) {
+		perror("a1fs: block write back failed");
+	}
+
+	// Pin lists of other threads are left behind; their destructors are not
+	// called once the key is deleted
+	pin_list *pl = pthread_getspecific(c->pins_key);
+	if (pl != NULL) {
+		free(pl->frames);
+		free(pl);
+	}
+	pthread_key_delete(c->pins_key);
+
+	for (size_t i = 0; i < c->num_frames; i++) {
+		free(c->frames[i]->data);
+		free(c->frames[i]);
+	}
+	for (int i = 0; i < c->num_regions; i++) free(c->regions[i].data);
+	free(c->frames);
+	free(c->buckets);
+	pthread_cond_destroy(&c->io_done);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+	close(dev->fd);
+}
+
+static const bdev_ops cache_ops = {
+	.map       = cache_map,
+	.get       = cache_get,
+	.put       = cache_put,
+	.release   = cache_release,
+	.writing   = cache_writing,
+	.writeback = cache_writeback,
+	.flush     = cache_flush,
+	.prefetch  = cache_prefetch,
+	.close     = cache_close,
+};
+
+bool bdev_open_pread(bdev *dev, const char *path, size_t cache_blocks)
+{
+	if (cache_blocks == 0) cache_blocks = 1;
+	bcache *c = calloc(1, sizeof(bcache));
+	if (c == NULL) return false;
+	c->capacity = cache_blocks;
+	c->frames_size = cache_blocks;
+	c->frames = malloc(c->frames_size * sizeof(frame *));
+	c->num_buckets = 1;
+	while (c->num_buckets < cache_blocks) c->num_buckets *= 2;
+	c->buckets = calloc(c->num_buckets, sizeof(frame *));
+	if ((c->frames == NULL) || (c->buckets == NULL)) goto fail;
+	if (pthread_key_create(&c->pins_key, free_pins) != 0) goto fail;
+
+	dev->fd = open_file(path, A1FS_BLOCK_SIZE, &dev->size);
+	if (dev->fd < 0) {
+		pthread_key_delete(c->pins_key);
+		goto fail;
+	}
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->io_done, NULL);
+	dev->ops = &cache_ops;
+	dev->contiguous = false;
+	dev->direct = false;
+	dev->image = NULL;
+	dev->cache = c;
+	return true;
+
+fail:
+	free(c->frames);
+	free(c->buckets);
+	free(c);
+	return false;
+}
@@ -0,0 +1,161 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block device backend implementation (mmap backend).
+ */
+
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "a1fs.h"
+#include "bdev.h"
+#include "map.h"
+
+
+static void *mmap_get(bdev *dev, uint64_t block)
+{
+	return (char *)dev->image + block * A1FS_BLOCK_SIZE;
+}
+
+static void *mmap_map(bdev *dev, uint64_t block, uint64_t count)
+{
+	(void)count;// unused
+	return mmap_get(dev, block);
+}
+
+// The mapping stays in place, so there is nothing to give back
+static void mmap_put(bdev *dev, const void *addr)
+{
+	(void)dev;// unused
+	(void)addr;// unused
+}
+
+static void mmap_release(bdev *dev)
+{
+	(void)dev;// unused
+}
+
+// The kernel tracks which pages are modified
+static void mmap_writing(bdev *dev)
+{
+	(void)dev;// unused
+}
+
+static int mmap_writeback(bdev *dev, uint64_t block, uint64_t count)
+{
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	// msync() needs a page aligned address; blocks may be smaller than pages
+	uintptr_t start = (uintptr_t)mmap_get(dev, block);
+	uintptr_t end = start + (uintptr_t)count * A1FS_BLOCK_SIZE;
+	start &= ~(page_size - 1);
+	if (msync((void *)start, end - start, MS_SYNC) != 0) return -errno;
+	return 0;
+}
+
+// msync(MS_SYNC) has waited already
+static int mmap_flush(bdev *dev)
+{
+	(void)dev;// unused
+	return 0;
+}
+
+static void mmap_prefetch(bdev *dev, uint64_t block, uint64_t count)
+{
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	// madvise() needs a page aligned address too
+	uintptr_t start = (uintptr_t)mmap_get(dev, block);
+	uintptr_t end = start + (uintptr_t)count * A1FS_BLOCK_SIZE;
+	start &= ~(page_size - 1);
+	// Only a hint; nothing to do if it fails
+	madvise((void *)start, end - start, MADV_WILLNEED);
+}
+
+static void mmap_close(bdev *dev)
+{
+	munmap(dev->image, dev->size);
+	close(dev->fd);
+}
+
+static const bdev_ops mmap_ops = {
+	.map       = mmap_map,
+	.get       = mmap_get,
+	.put       = mmap_put,
+	.release   = mmap_release,
+	.writing   = mmap_writing,
+	.writeback = mmap_writeback,
+	.flush     = mmap_flush,
+	.prefetch  = mmap_prefetch,
+	.close     = mmap_close,
+};
+
+bool bdev_open_mmap(bdev *dev, const char *path, int flags)
+{
+	dev->image = map_file(path, A1FS_BLOCK_SIZE, &dev->size, flags, &dev->fd);
+	if (dev->image == NULL) return false;
+	dev->ops = &mmap_ops;
+	dev->contiguous = true;
+	dev->direct = true;
+	dev->cache = NULL;
+	return true;
+}
+
+
+void *bdev_map(bdev *dev, uint64_t block, uint64_t count)
+{
+	return dev->ops->map(dev, block, count);
+}
+
+void *bdev_get(bdev *dev, uint64_t block)
+{
+	return dev->ops->get(dev, block);
+}
+
+void bdev_put(bdev *dev, const void *addr)
+{
+	dev->ops->put(dev, addr);
+}
+
+void bdev_release(bdev *dev)
+{
+	dev->ops->release(dev);
+}
+
+void bdev_writing(bdev *dev)
+{
+	dev->ops->writing(dev);
+}
+
+int bdev_writeback(bdev *dev, uint64_t block, uint64_t count)
+{
+	return dev->ops->writeback(dev, block, count);
+}
+
+int bdev_flush(bdev *dev)
+{
+	return dev->ops->flush(dev);
+}
+
+void bdev_prefetch(bdev *dev, uint64_t block, uint64_t count)
+{
+	dev->ops->prefetch(dev, block, count);
+}
+
+void bdev_close(bdev *dev)
+{
+	if (dev->ops == NULL) return;
+	dev->ops->close(dev);
+	dev->ops = NULL;
+}
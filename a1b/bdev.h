@@ -0,0 +1,162 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Block device backend header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+//NOTE: all access to the image goes through a block device backend. Blocks are
+// numbered from the start of the image and are A1FS_BLOCK_SIZE bytes long.
+//
+// Two backends are available:
+//  - mmap: the whole image is mapped into memory (map_file()); the kernel
+//    caches it and writes it back. Blocks are never released.
+//  - pread: blocks are read with pread() into a user-space cache of a given
+//    size and written back with pwrite(). Images may be larger than the address
+//    space and than memory.
+//
+// A pointer returned by bdev_get() stays valid until the calling thread calls
+// bdev_put() on it or bdev_release(). Blocks that the calling thread uses after
+// bdev_writing() are considered modified and are written back before they are
+// evicted from the cache. Ranges returned by bdev_map() stay valid until the
+// device is closed.
+
+typedef struct bdev bdev;
+struct bcache;
+
+/** Implementation of a backend; see the bdev_*() functions below. */
+typedef struct bdev_ops {
+	void *(*map)(bdev *dev, uint64_t block, uint64_t count);
+	void *(*get)(bdev *dev, uint64_t block);
+	void (*put)(bdev *dev, const void *addr);
+	void (*release)(bdev *dev);
+	void (*writing)(bdev *dev);
+	int (*writeback)(bdev *dev, uint64_t block, uint64_t count);
+	int (*flush)(bdev *dev);
+	void (*prefetch)(bdev *dev, uint64_t block, uint64_t count);
+	void (*close)(bdev *dev);
+
+} bdev_ops;
+
+/** An open image. */
+struct bdev {
+	/** Backend implementation; NULL if the device is not open. */
+	const bdev_ops *ops;
+	/** Open file descriptor of the image. */
+	int fd;
+	/** Image size in bytes. */
+	size_t size;
+	/** Whether consecutive blocks are at consecutive addresses, i.e. a pointer
+	 * to a block can be used to access the blocks after it too. */
+	bool contiguous;
+	/** Whether the image file is kept up to date with every change, so its
+	 * blocks can be read and written through fd directly (mmap backend). */
+	bool direct;
+	/** Start of the image mapping (mmap backend); NULL otherwise. */
+	void *image;
+	/** Block cache (pread backend); NULL otherwise. */
+	struct bcache *cache;
+
+};
+
+/**
+ * Open an image by mapping it into memory.
+ *
+ * @param dev    device to initialize.
+ * @param path   image file path.
+ * @param flags  mmap() flags to add to MAP_SHARED (e.g. MAP_POPULATE).
+ * @return       true on success; false on failure.
+ */
+bool bdev_open_mmap(bdev *dev, const char *path, int flags);
+
+/**
+ * Open an image for access with pread() and pwrite() through a block cache.
+ *
+ * @param dev           device to initialize.
+ * @param path          image file path.
+ * @param cache_blocks  number of blocks the cache holds; it only grows past
+ *                      that while more blocks than that are in use at once.
+ * @return              true on success; false on failure.
+ */
+bool bdev_open_pread(bdev *dev, const char *path, size_t cache_blocks);
+
+/**
+ * Keep count blocks starting at block resident for as long as the device is
+ * open, at consecutive addresses, e.g. the superblock and bitmaps.
+ *
+ * The blocks of the range must not be in use through bdev_get(). Only
+ * bdev_writeback() and bdev_close() write the range back.
+ *
+ * @return  pointer to the first block; NULL if out of memory or on I/O error.
+ */
+void *bdev_map(bdev *dev, uint64_t block, uint64_t count);
+
+/**
+ * Get a block for the calling thread. Blocks in a range given to bdev_map()
+ * come from that range. I/O errors are fatal, as they are for the mapping.
+ *
+ * @return  pointer to the block.
+ */
+void *bdev_get(bdev *dev, uint64_t block);
+
+/**
+ * Give back one use of a block the calling thread got with bdev_get().
+ *
+ * @param addr  pointer to anywhere within the block.
+ */
+void bdev_put(bdev *dev, const void *addr);
+
+/** Give back all the blocks the calling thread got with bdev_get(). */
+void bdev_release(bdev *dev);
+
+/**
+ * Mark the blocks the calling thread has in use, and all blocks it gets until
+ * its next bdev_release(), as modified.
+ */
+void bdev_writing(bdev *dev);
+
+/**
+ * Write count blocks starting at block back to the image file if they were
+ * modified. Only the mmap backend waits for them to reach the disk; call
+ * bdev_flush() after writing back all the blocks that need to.
+ *
+ * @return  0 on success; -errno on failure.
+ */
+int bdev_writeback(bdev *dev, uint64_t block, uint64_t count);
+
+/**
+ * Wait for the blocks written back so far to reach the disk.
+ *
+ * @return  0 on success; -errno on failure.
+ */
+int bdev_flush(bdev *dev);
+
+/**
+ * Hint that count blocks starting at block will be read soon, so that reading
+ * them from the image file can start in the background.
+ */
+void bdev_prefetch(bdev *dev, uint64_t block, uint64_t count);
+
+/**
+ * Close the device. The pread backend writes back all modified blocks first;
+ * the mmap backend leaves that to the kernel.
+ */
+void bdev_close(bdev *dev);
@@ -0,0 +1,568 @@
+# constants
+root="/tmp/a1fs_bench"
+image="bench_image"
+image_size=1G
+inodes=16384
+file_mb=64
+
+# Assumptions
+# we assume the script is ran in the working repository
+# We assume that root is an existing empty directory
+#
+# usage: ./bench.sh <benchmark>
+#   threads   read/write throughput vs number of parallel clients, for the
+#             single-threaded and the multithreaded mount
+#   seq       sequential write/read throughput of one large file for a range
+#             of request sizes, and the CPU time the file system process
+#             spends per GB
+#   lookup    average stat() latency and directory size vs number of entries,
+#             for fixed size and compact (mkfs -c) directory entries
+#   alloc     file create + first block allocation latency vs image size and
+#             fill level (the bitmap search cost)
+#   unlink    time to truncate and unlink large files
+#   extend    time to extend a file by truncate and by a write far past EOF,
+#             and the space the sparse result takes
+#   frag      extents per file (user.a1fs.extents) of logs grown by small
+#             appends on a fresh and on an aged file system
+#   fsync     latency of fsync() of a small file vs the amount of data another
+#             file has not written back yet
+#   sync      write and file create throughput for each -o sync= mode
+#   mmap      mount time, page faults and latency of a metadata heavy and a
+#             sequential read workload for each image mapping hint option
+#   backend   write/read throughput of a file larger than the block cache and
+#             the resident memory of the file system process, for the mmap
+#             backend and the pread backend with a range of cache sizes
+#   falloc    extents and time of fallocate() preallocation on a fresh and an
+#             aged file system, and the space returned by punching holes
+#   driver    stat() latency of files deep in the tree and 4 KiB read
+#             throughput and CPU time, for the path based driver and the
+#             low-level (-o lowlevel) driver
+#   small     space taken and cold read time of many small files, for 64 byte
+#             inodes and for larger ones holding the data inline (mkfs -I)
+#   large     sequential throughput and random 4 KiB read and write latency of
+#             a file of large_gb GB (default 10; e.g. large_gb=100 ./bench.sh
+#             large), for the mmap and the pread backend; the image needs
+#             that much free space on the host
+#   groups    file create + write time and cold stat() + read time of small
+#             files in many directories on a half full 4 GB image, with and
+#             without block groups (mkfs -g)
+
+# format a fresh image (with the mkfs options in mkfs_opts) and mount it with
+# the given mount options
+mount_fresh() {
+	fusermount -u ${root} 2>/dev/null
+	rm -f ${image}
+	truncate -s ${image_size} ${image}
+	./mkfs.a1fs -f -i ${inodes} ${mkfs_opts} ${image}
+	./a1fs ${image} ${root} "$@"
+}
+
+# remount the image (drops the kernel page cache for the mount)
+remount() {
+	fusermount -u ${root}
+	./a1fs ${image} ${root} "$@"
+}
+
+now() {
+	date +%s.%N
+}
+
+# CPU time (user + system) used so far by the mounted file system process, in
+# clock ticks
+fs_cpu() {
+	pid=$(pgrep -n -f "a1fs ${image} ${root}")
+	awk '{ print $14 + $15 }' /proc/${pid}/stat
+}
+
+# minor and major page faults so far of the mounted file system process
+fs_faults() {
+	pid=$(pgrep -n -f "a1fs ${image} ${root}")
+	awk '{ print $10, $12 }' /proc/${pid}/stat
+}
+
+# print the page faults between <before> and <after> (each "minor major")
+faults() {
+	echo $1 $2 $3 $4 | awk '{ printf "  faults minor %8d  major %6d\n", $3 - $1, $4 - $2 }'
+}
+
+# resident memory of the mounted file system process, in MB
+fs_rss() {
+	pid=$(pgrep -n -f "a1fs ${image} ${root}")
+	awk '/VmRSS/ { printf "%d", $2 / 1024 }' /proc/${pid}/status
+}
+
+# print the CPU seconds per GB for <megabytes> processed between <start> and
+# <end> clock ticks
+cpu_per_gb() {
+	awk -v mb=$1 -v s=$2 -v e=$3 -v hz=$(getconf CLK_TCK) \
+		'BEGIN { printf "  %6.2f s CPU/GB\n", (e - s) / hz / (mb / 1024) }'
+}
+
+# print MB/s for <megabytes> transferred between <start> and <end>
+rate() {
+	awk -v mb=$1 -v s=$2 -v e=$3 'BEGIN { printf "%8.1f MB/s\n", mb / (e - s) }'
+}
+
+# write and then read back <n> files of file_mb each, one dd per file
+parallel_io() {
+	n=$1
+	shift
+	start=$(now)
+	for i in $(seq 1 ${n}); do
+		dd if=/dev/zero of=${root}/f${i} bs=4k count=$((file_mb * 256)) 2>/dev/null &
+	done
+	wait
+	end=$(now)
+	printf "  clients %2d  write " ${n}
+	rate $((n * file_mb)) ${start} ${end}
+
+	remount "$@"
+	start=$(now)
+	for i in $(seq 1 ${n}); do
+		dd if=${root}/f${i} of=/dev/null bs=4k 2>/dev/null &
+	done
+	wait
+	end=$(now)
+	printf "  clients %2d  read  " ${n}
+	rate $((n * file_mb)) ${start} ${end}
+}
+
+bench_threads() {
+	for mode in "" "-o multithreaded"; do
+		echo "mount options: ${mode:-(single-threaded)}"
+		for n in 1 2 4 8; do
+			mount_fresh ${mode}
+			parallel_io ${n} ${mode}
+		done
+	done
+}
+
+bench_seq() {
+	mb=512
+	for bs in 4096 131072 1048576; do
+		mount_fresh
+		cpu=$(fs_cpu)
+		start=$(now)
+		dd if=/dev/zero of=${root}/seq bs=${bs} count=$((mb * 1024 * 1024 / bs)) 2>/dev/null
+		end=$(now)
+		printf "  bs %7d  write " ${bs}
+		rate ${mb} ${start} ${end} | tr -d '\n'
+		cpu_per_gb ${mb} ${cpu} $(fs_cpu)
+
+		remount
+		cpu=$(fs_cpu)
+		start=$(now)
+		dd if=${root}/seq of=/dev/null bs=${bs} 2>/dev/null
+		end=$(now)
+		printf "  bs %7d  read  " ${bs}
+		rate ${mb} ${start} ${end} | tr -d '\n'
+		cpu_per_gb ${mb} ${cpu} $(fs_cpu)
+	done
+}
+
+# time stat() of random entries of a directory with <n> entries
+lookup_dir() {
+	n=$1
+	mount_fresh
+	mkdir ${root}/d
+	for i in $(seq 1 ${n}); do
+		: > ${root}/d/file_${i}
+	done
+
+	# remount so that every stat() below misses the kernel dentry cache
+	remount
+	probes=1000
+	start=$(now)
+	for i in $(seq 1 ${probes}); do
+		echo ${root}/d/file_$(( (i * 7919) % n + 1 ))
+	done | xargs stat --format=%i > /dev/null
+	end=$(now)
+	size=$(stat --format=%s ${root}/d)
+	awk -v n=${n} -v p=${probes} -v s=${start} -v e=${end} -v b=${size} \
+		'BEGIN { printf "  entries %5d  %8.1f us/stat  %6d KiB\n", n, (e - s) * 1e6 / p, b / 1024 }'
+}
+
+bench_lookup() {
+	for mkfs_opts in "" "-c"; do
+		echo "mkfs options: ${mkfs_opts:-(fixed size entries)}"
+		for n in 16 64 256 1024 4096 8000; do
+			lookup_dir ${n}
+		done
+	done
+	mkfs_opts=""
+}
+
+bench_alloc() {
+	for image_size in 256M 1G 4G; do
+		echo "image size: ${image_size}"
+		mb=$(numfmt --from=iec ${image_size})
+		mb=$((mb / 1024 / 1024))
+		for fill in 0 50 90 99; do
+			mount_fresh
+			# one big file takes the lowest blocks, so every search has to
+			# skip the used part of the bitmap
+			dd if=/dev/zero of=${root}/fill bs=1M count=$((mb * fill / 100)) 2>/dev/null
+			files=200
+			start=$(now)
+			for i in $(seq 1 ${files}); do
+				echo x > ${root}/f${i}
+			done
+			end=$(now)
+			awk -v f=${fill} -v n=${files} -v s=${start} -v e=${end} \
+				'BEGIN { printf "  fill %2d%%  %8.1f us/file\n", f, (e - s) * 1e6 / n }'
+		done
+	done
+	image_size=1G
+}
+
+bench_unlink() {
+	for mb in 64 256 768; do
+		mount_fresh
+		dd if=/dev/zero of=${root}/big bs=1M count=${mb} 2>/dev/null
+		start=$(now)
+		truncate -s $((mb / 2))M ${root}/big
+		end=$(now)
+		awk -v m=${mb} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  %4d MB  truncate to half  %8.2f ms\n", m, (e - s) * 1e3 }'
+		start=$(now)
+		rm ${root}/big
+		end=$(now)
+		awk -v m=${mb} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  %4d MB  unlink            %8.2f ms\n", m, (e - s) * 1e3 }'
+	done
+}
+
+bench_extend() {
+	for mb in 64 256 768; do
+		mount_fresh
+		start=$(now)
+		truncate -s ${mb}M ${root}/t
+		end=$(now)
+		blocks=$(stat --format=%b ${root}/t)
+		awk -v m=${mb} -v s=${start} -v e=${end} -v b=${blocks} \
+			'BEGIN { printf "  %4d MB  truncate          %8.2f ms  %8d KiB\n", m, (e - s) * 1e3, b / 2 }'
+		start=$(now)
+		dd if=/dev/zero of=${root}/w bs=4k count=1 seek=$((mb * 256 - 1)) 2>/dev/null
+		end=$(now)
+		blocks=$(stat --format=%b ${root}/w)
+		awk -v m=${mb} -v s=${start} -v e=${end} -v b=${blocks} \
+			'BEGIN { printf "  %4d MB  write past EOF    %8.2f ms  %8d KiB\n", m, (e - s) * 1e3, b / 2 }'
+	done
+}
+
+# append <n> lines to <log>, creating a small file every 50 appends
+grow_log() {
+	log=$1
+	n=$2
+	for i in $(seq 1 ${n}); do
+		echo "$(date) log line ${i} with some padding to make it longer" >> ${log}
+		if [ $((i % 50)) -eq 0 ]; then
+			echo x > ${log}.${i}
+		fi
+	done
+}
+
+bench_frag() {
+	for age in fresh aged; do
+		mount_fresh
+		if [ ${age} = aged ]; then
+			# leave free space in many one block holes
+			for i in $(seq 1 2000); do
+				echo x > ${root}/old${i}
+			done
+			for i in $(seq 1 2 2000); do
+				rm ${root}/old${i}
+			done
+		fi
+		grow_log ${root}/log1 20000
+		grow_log ${root}/log2 10000 & grow_log ${root}/log3 10000 & wait
+		for log in log1 log2 log3; do
+			blocks=$(( ($(stat --format=%s ${root}/${log}) + 4095) / 4096 ))
+			extents=$(getfattr --only-values -n user.a1fs.extents ${root}/${log})
+			printf "  %s  %s  blocks %5d  extents %5d\n" ${age} ${log} ${blocks} ${extents}
+		done
+	done
+}
+
+bench_fsync() {
+	for mb in 0 256 768; do
+		mount_fresh
+		dd if=/dev/zero of=${root}/big bs=1M count=${mb} 2>/dev/null
+		start=$(now)
+		dd if=/dev/zero of=${root}/small bs=4k count=1 conv=fsync 2>/dev/null
+		end=$(now)
+		awk -v m=${mb} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  %4d MB dirty  fsync small file  %8.2f ms\n", m, (e - s) * 1e3 }'
+	done
+}
+
+bench_sync() {
+	mb=64
+	files=500
+	for mode in none periodic:1000 periodic:100 always; do
+		echo "sync mode: ${mode}"
+		mount_fresh -o sync=${mode}
+		start=$(now)
+		dd if=/dev/zero of=${root}/seq bs=4k count=$((mb * 256)) 2>/dev/null
+		end=$(now)
+		printf "  write 4k  "
+		rate ${mb} ${start} ${end}
+		start=$(now)
+		for i in $(seq 1 ${files}); do
+			echo x > ${root}/f${i}
+		done
+		end=$(now)
+		awk -v n=${files} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  create    %8.1f us/file\n", (e - s) * 1e6 / n }'
+	done
+}
+
+bench_mmap() {
+	files=2000
+	mb=256
+	for hints in "" "-o populate" "-o prefetch_meta" "-o hugepage" \
+		"-o access=random" "-o access=sequential"; do
+		echo "mount options: ${hints:-(none)}"
+		mount_fresh
+		dd if=/dev/zero of=${root}/seq bs=1M count=${mb} 2>/dev/null
+		for i in $(seq 1 ${files}); do
+			: > ${root}/f${i}
+		done
+		fusermount -u ${root}
+		# start from a cold page cache so that every hint has the same work
+		sync
+		echo 1 > /proc/sys/vm/drop_caches 2>/dev/null
+		start=$(now)
+		./a1fs ${image} ${root} ${hints}
+		end=$(now)
+		awk -v s=${start} -v e=${end} 'BEGIN { printf "  mount   %8.2f ms\n", (e - s) * 1e3 }'
+
+		before=$(fs_faults)
+		start=$(now)
+		ls -l ${root} > /dev/null
+		end=$(now)
+		awk -v n=${files} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  stat    %8.1f us/file", (e - s) * 1e6 / n }'
+		faults ${before} $(fs_faults)
+
+		before=$(fs_faults)
+		start=$(now)
+		dd if=${root}/seq of=/dev/null bs=128k 2>/dev/null
+		end=$(now)
+		printf "  read  "
+		rate ${mb} ${start} ${end} | tr -d '\n'
+		faults ${before} $(fs_faults)
+	done
+}
+
+bench_backend() {
+	mb=512
+	for backend in "-o backend=mmap" "-o backend=pread,cache_mb=16" \
+		"-o backend=pread,cache_mb=64" "-o backend=pread,cache_mb=256"; do
+		echo "${backend}"
+		mount_fresh ${backend}
+		start=$(now)
+		dd if=/dev/zero of=${root}/seq bs=1M count=${mb} 2>/dev/null
+		end=$(now)
+		printf "  write "
+		rate ${mb} ${start} ${end}
+
+		remount ${backend}
+		start=$(now)
+		dd if=${root}/seq of=/dev/null bs=128k 2>/dev/null
+		end=$(now)
+		printf "  read  "
+		rate ${mb} ${start} ${end} | tr -d '\n'
+		echo "  rss $(fs_rss) MB"
+	done
+}
+
+bench_driver() {
+	files=1000
+	mb=256
+	for driver in "" "-o lowlevel"; do
+		echo "mount options: ${driver:-(path based)}"
+		mount_fresh ${driver}
+		dir=${root}/a/b/c/d/e/f/g/h
+		mkdir -p ${dir}
+		for i in $(seq 1 ${files}); do
+			: > ${dir}/file_${i}
+		done
+		dd if=/dev/zero of=${root}/seq bs=1M count=${mb} 2>/dev/null
+
+		# the second pass finds the names in the kernel dentry cache
+		for pass in cold warm; do
+			[ ${pass} = cold ] && remount ${driver}
+			start=$(now)
+			for i in $(seq 1 ${files}); do
+				echo ${dir}/file_${i}
+			done | xargs stat --format=%i > /dev/null
+			end=$(now)
+			awk -v p=${pass} -v n=${files} -v s=${start} -v e=${end} \
+				'BEGIN { printf "  stat %s %8.1f us/file\n", p, (e - s) * 1e6 / n }'
+		done
+
+		remount ${driver}
+		cpu=$(fs_cpu)
+		start=$(now)
+		dd if=${root}/seq of=/dev/null bs=4k 2>/dev/null
+		end=$(now)
+		printf "  read 4k   "
+		rate ${mb} ${start} ${end} | tr -d '\n'
+		cpu_per_gb ${mb} ${cpu} $(fs_cpu)
+	done
+}
+
+bench_small() {
+	files=2000
+	for mkfs_opts in "" "-I 256"; do
+		echo "mkfs options: ${mkfs_opts:-(64 byte inodes)}"
+		mount_fresh
+		mkdir ${root}/etc
+		free=$(stat -f --format=%f ${root})
+		for i in $(seq 1 ${files}); do
+			echo "key${i} = value${i}" > ${root}/etc/conf${i}
+		done
+		used=$(( (free - $(stat -f --format=%f ${root})) * 4 ))
+		printf "  %d files  %8d KiB\n" ${files} ${used}
+
+		remount
+		start=$(now)
+		cat ${root}/etc/conf* > /dev/null
+		end=$(now)
+		awk -v n=${files} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  read cold %8.1f us/file\n", (e - s) * 1e6 / n }'
+	done
+	mkfs_opts=""
+}
+
+bench_falloc() {
+	for age in fresh aged; do
+		mount_fresh
+		if [ ${age} = aged ]; then
+			for i in $(seq 1 2000); do
+				echo x > ${root}/old${i}
+			done
+			for i in $(seq 1 2 2000); do
+				rm ${root}/old${i}
+			done
+		fi
+		start=$(now)
+		fallocate -l 256M ${root}/db
+		end=$(now)
+		extents=$(getfattr --only-values -n user.a1fs.extents ${root}/db)
+		awk -v a=${age} -v x=${extents} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  %s  fallocate 256 MB  %8.2f ms  extents %5d\n", a, (e - s) * 1e3, x }'
+
+		# punch out every other MB
+		before=$(stat --format=%b ${root}/db)
+		for i in $(seq 0 2 255); do
+			fallocate -p -o ${i}M -l 1M ${root}/db
+		done
+		after=$(stat --format=%b ${root}/db)
+		printf "  %s  punch 128 x 1 MB   KiB %8d -> %8d\n" ${age} $((before / 2)) $((after / 2))
+	done
+}
+
+bench_large() {
+	gb=${large_gb:-10}
+	mb=$((gb * 1024))
+	blocks=$((mb * 256))
+	ops=2000
+	image_size=$((gb + 1))G
+	for backend in "-o backend=mmap" "-o backend=pread,cache_mb=256"; do
+		echo "${backend}  file ${gb} GB"
+		mount_fresh ${backend}
+		start=$(now)
+		dd if=/dev/zero of=${root}/big bs=1M count=${mb} 2>/dev/null
+		end=$(now)
+		printf "  seq write     "
+		rate ${mb} ${start} ${end}
+		size=$(stat --format=%s ${root}/big)
+		[ ${size} -eq $((mb * 1024 * 1024)) ] || echo "  size ${size}, expected $((mb * 1024 * 1024))"
+
+		remount ${backend}
+		start=$(now)
+		dd if=${root}/big of=/dev/null bs=1M 2>/dev/null
+		end=$(now)
+		printf "  seq read      "
+		rate ${mb} ${start} ${end}
+
+		# offsets spread over the whole file, so most of them are past 4 GB
+		remount ${backend}
+		start=$(now)
+		for i in $(seq 1 ${ops}); do
+			dd if=${root}/big of=/dev/null bs=4k count=1 skip=$(( (i * 2654435761) % blocks )) 2>/dev/null
+		done
+		end=$(now)
+		awk -v n=${ops} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  random read   %8.1f us/op\n", (e - s) * 1e6 / n }'
+		start=$(now)
+		for i in $(seq 1 ${ops}); do
+			dd if=/dev/zero of=${root}/big bs=4k count=1 seek=$(( (i * 2654435761) % blocks )) \
+				conv=notrunc 2>/dev/null
+		done
+		end=$(now)
+		awk -v n=${ops} -v s=${start} -v e=${end} \
+			'BEGIN { printf "  random write  %8.1f us/op\n", (e - s) * 1e6 / n }'
+	done
+	rm -f ${root}/big
+	image_size=1G
+}
+
+bench_groups() {
+	dirs=100
+	files=50
+	image_size=4G
+	for mkfs_opts in "" "-g"; do
+		echo "mkfs options: ${mkfs_opts:-(no block groups)}"
+		mount_fresh
+		# the fill takes the free space a flat image would put the files in
+		dd if=/dev/zero of=${root}/fill bs=1M count=2048 2>/dev/null
+		start=$(now)
+		for d in $(seq 1 ${dirs}); do
+			mkdir ${root}/d${d}
+			for f in $(seq 1 ${files}); do
+				head -c 10000 /dev/zero > ${root}/d${d}/f${f}
+			done
+		done
+		end=$(now)
+		awk -v n=$((dirs * files)) -v s=${start} -v e=${end} \
+			'BEGIN { printf "  create    %8.1f us/file\n", (e - s) * 1e6 / n }'
+
+		remount
+		start=$(now)
+		for d in $(seq 1 ${dirs}); do
+			cat ${root}/d${d}/* > /dev/null
+		done
+		end=$(now)
+		awk -v n=$((dirs * files)) -v s=${start} -v e=${end} \
+			'BEGIN { printf "  read cold %8.1f us/file\n", (e - s) * 1e6 / n }'
+	done
+	mkfs_opts=""
+	image_size=1G
+}
+
+make
+case "$1" in
+	threads) bench_threads ;;
+	seq) bench_seq ;;
+	lookup) bench_lookup ;;
+	alloc) bench_alloc ;;
+	unlink) bench_unlink ;;
+	extend) bench_extend ;;
+	frag) bench_frag ;;
+	fsync) bench_fsync ;;
+	sync) bench_sync ;;
+	mmap) bench_mmap ;;
+	backend) bench_backend ;;
+	falloc) bench_falloc ;;
+	driver) bench_driver ;;
+	small) bench_small ;;
+	large) bench_large ;;
+	groups) bench_groups ;;
+	*) echo "usage: $0 threads|seq|lookup|alloc|unlink|extend|frag|fsync|sync|mmap|backend|falloc|driver|small|large|groups"; exit 1 ;;
+esac
+
+# unmount the file system
+fusermount -u ${root}
@@ -0,0 +1,147 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap search implementation.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitmap.h"
+
+
+/**
+ * return word word_index of bitmap, with bit 0 of the bitmap in the most significant bit
+**/
+static uint64_t load_word(const unsigned char *bitmap, uint64_t word_index){
+	uint64_t word;
+	memcpy(&word, bitmap + word_index * sizeof(word), sizeof(word));
+	return be64toh(word);
+}
+
+int search_bitmap(unsigned char *bitmap, uint32_t num_bits, unsigned int length, a1fs_extent *extent){
+	uint64_t num_words = ((uint64_t)num_bits + 63) / 64;
+	//the free run currently being extended
+	uint64_t start = 0;
+	uint64_t count = 0;
+	extent->count = 0;
+
+	for(uint64_t w = 0; w < num_words; w++){
+		uint64_t word = load_word(bitmap, w);
+		//treat the bits past the end of the bitmap as used
+		if(w == num_words - 1 && num_bits % 64 != 0) word |= UINT64_MAX >> (num_bits % 64);
+
+		//whole words of used or free bits need no bit scanning
+		if(word == UINT64_MAX){
+			if(count > extent->count){
+				extent->start = start;
+				extent->count = count;
+			}
+			count = 0;
+			continue;
+		}
+		if(word == 0){
+			if(count == 0) start = w * 64;
+			count += 64;
+			if(count >= length){
+				extent->start = start;
+				extent->count = length;
+				return 0;
+			}
+			continue;
+		}
+
+		//alternate between the run of free (leading zero) and used (leading one) bits at bit
+		unsigned int bit = 0;
+		while(bit < 64){
+			uint64_t rest = word << bit;
+			unsigned int zeros = (rest == 0) ? 64 - bit : (unsigned int)__builtin_clzll(rest);
+			if(zeros > 0){
+				if(count == 0) start = w * 64 + bit;
+				count += zeros;
+				if(count >= length){
+					extent->start = start;
+					extent->count = length;
+					return 0;
+				}
+				bit += zeros;
+				if(bit == 64) break;
+				rest = word << bit;
+			}
+
+			if(count > extent->count){
+				extent->start = start;
+				extent->count = count;
+			}
+			count = 0;
+			bit += __builtin_clzll(~rest);
+		}
+	}
+	//a free run reaching the end of the bitmap
+	if(count > extent->count){
+		extent->start = start;
+		extent->count = count;
+	}
+	if(extent->count == 0) return -ENOSPC;
+	return 0;
+}
+
+uint32_t bitmap_find_next(const unsigned char *bitmap, uint32_t num_bits, uint32_t from, bool set){
+	while(from < num_bits){
+		uint64_t word = load_word(bitmap, from / 64);
+		if(!set) word = ~word;
+		//ignore the bits of the word before from
+		word &= UINT64_MAX >> (from % 64);
+		if(word != 0){
+			from = from - from % 64 + __builtin_clzll(word);
+			return from < num_bits ? from : num_bits;
+		}
+		from = from - from % 64 + 64;
+	}
+	return num_bits;
+}
+
+/**
+ * set or clear the bits of byte selected by mask
+**/
+static void set_bits(unsigned char *byte, unsigned char mask, bool used){
+	if(used) *byte |= mask;
+	else *byte &= ~mask;
+}
+
+void bitmap_set_range(unsigned char *bitmap, uint32_t start, uint32_t count, bool used){
+	uint32_t end = start + count;
+	if(count == 0) return;
+
+	//the range lies within a single byte
+	if(start / 8 == (end - 1) / 8){
+		unsigned char mask = (0xff >> (start % 8)) & (0xff << (7 - (end - 1) % 8));
+		set_bits(&bitmap[start / 8], mask, used);
+		return;
+	}
+
+	//partial bytes at either edge, whole bytes in between
+	if(start % 8 != 0){
+		set_bits(&bitmap[start / 8], 0xff >> (start % 8), used);
+		start = start - start % 8 + 8;
+	}
+	if(end % 8 != 0){
+		set_bits(&bitmap[end / 8], 0xff << (8 - end % 8), used);
+		end -= end % 8;
+	}
+	if(end > start) memset(bitmap + start / 8, used ? 0xff : 0, (end - start) / 8);
+}
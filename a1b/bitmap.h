@@ -0,0 +1,56 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Bitmap search header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+//NOTE: bit n of a bitmap is the bit (1 << (7 - n % 8)) of byte n / 8, i.e. bits
+// are numbered from the most significant bit of each byte. A set bit marks a
+// used inode or block. The bitmap must be readable up to the next multiple of
+// 8 bytes past num_bits, which always holds for bitmaps stored in whole blocks.
+
+/**
+ * search the given bitmap for an extent of length length
+ * 
+ * populate the extent struct given with the first extent found of length length, or,
+ * if none exist, the extent of longest length (the first one of that length)
+ * 
+ * @param bitmap    pointer to the start of the bitmap
+ * @param num_bits  the number of bits belonging ot the bitmap
+ * @param length    the length of the extent we are searching for
+ * @param extent    extent struct to populate 
+ * @return          0 on success, -ENOSPC on error e.g no space
+ */
+int search_bitmap(unsigned char *bitmap, uint32_t num_bits, unsigned int length, a1fs_extent *extent);
+
+/**
+ * return the number of the first bit at or after from that is set (if set is true)
+ * or clear (if set is false), num_bits if there is none
+**/
+uint32_t bitmap_find_next(const unsigned char *bitmap, uint32_t num_bits, uint32_t from, bool set);
+
+/**
+ * set (if used is true) or clear count bits of bitmap starting at bit start
+ * whole bytes in the middle of the range are written with a single memset
+**/
+void bitmap_set_range(unsigned char *bitmap, uint32_t start, uint32_t count, bool used);
@@ -0,0 +1,149 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry lookup cache implementation.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dcache.h"
+#include "util.h"
+
+
+/** FNV-1a hash of the (parent, name) key. */
+static uint32_t dcache_hash(a1fs_ino_t parent, const char *name)
+{
+	uint32_t h = 2166136261u ^ parent;
+	for (const unsigned char *c = (const unsigned char *)name; *c; c++) {
+		h = (h ^ *c) * 16777619u;
+	}
+	return h;
+}
+
+static int *dcache_bucket(dcache *dc, a1fs_ino_t parent, const char *name)
+{
+	return &dc->buckets[dcache_hash(parent, name) & (dc->num_buckets - 1)];
+}
+
+/** Find the slot holding (parent, name); the caller must hold the lock. */
+static dcache_entry *dcache_find(dcache *dc, a1fs_ino_t parent, const char *name)
+{
+	for (int i = *dcache_bucket(dc, parent, name); i != -1; i = dc->entries[i].next) {
+		dcache_entry *e = &dc->entries[i];
+		if (e->parent == parent && strcmp(e->name, name) == 0) return e;
+	}
+	return NULL;
+}
+
+/** Unlink slot i from its hash bucket and mark it free. */
+static void dcache_unlink(dcache *dc, int i)
+{
+	dcache_entry *e = &dc->entries[i];
+	int *link = dcache_bucket(dc, e->parent, e->name);
+	while (*link != i) link = &dc->entries[*link].next;
+	*link = e->next;
+	e->valid = false;
+}
+
+/** Pick a free slot, evicting an entry with the CLOCK policy if needed. */
+static int dcache_victim(dcache *dc)
+{
+	while (true) {
+		int i = dc->hand;
+		dcache_entry *e = &dc->entries[i];
+		dc->hand = (dc->hand + 1) % dc->capacity;
+
+		if (!e->valid) return i;
+		if (e->referenced) {
+			// Give it a second chance
+			e->referenced = false;
+			continue;
+		}
+		dcache_unlink(dc, i);
+		return i;
+	}
+}
+
+
+bool dcache_init(dcache *dc, size_t capacity)
+{
+	dc->capacity = capacity;
+	// Keep the average chain length below one
+	dc->num_buckets = 1;
+	while (dc->num_buckets < capacity) dc->num_buckets *= 2;
+	assert(is_powerof2(dc->num_buckets));
+
+	dc->entries = calloc(capacity, sizeof(dcache_entry));
+	dc->buckets = malloc(dc->num_buckets * sizeof(int));
+	if (dc->entries == NULL || dc->buckets == NULL) {
+		free(dc->entries);
+		free(dc->buckets);
+		return false;
+	}
+	memset(dc->buckets, -1, dc->num_buckets * sizeof(int));
+	dc->hand = 0;
+	pthread_mutex_init(&dc->lock, NULL);
+	return true;
+}
+
+void dcache_destroy(dcache *dc)
+{
+	free(dc->entries);
+	free(dc->buckets);
+	pthread_mutex_destroy(&dc->lock);
+}
+
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino)
+{
+	pthread_mutex_lock(&dc->lock);
+	dcache_entry *e = dcache_find(dc, parent, name);
+	if (e != NULL) {
+		e->referenced = true;
+		*ino = e->ino;
+	}
+	pthread_mutex_unlock(&dc->lock);
+	return e != NULL;
+}
+
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, a1fs_ino_t ino)
+{
+	pthread_mutex_lock(&dc->lock);
+	dcache_entry *e = dcache_find(dc, parent, name);
+	if (e == NULL) {
+		int i = dcache_victim(dc);
+		e = &dc->entries[i];
+		e->parent = parent;
+		strncpy(e->name, name, A1FS_NAME_MAX - 1);
+		e->name[A1FS_NAME_MAX - 1] = '\0';
+		e->valid = true;
+
+		int *bucket = dcache_bucket(dc, parent, e->name);
+		e->next = *bucket;
+		*bucket = i;
+	}
+	e->ino = ino;
+	e->referenced = false;
+	pthread_mutex_unlock(&dc->lock);
+}
+
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name)
+{
+	pthread_mutex_lock(&dc->lock);
+	dcache_entry *e = dcache_find(dc, parent, name);
+	if (e != NULL) dcache_unlink(dc, e - dc->entries);
+	pthread_mutex_unlock(&dc->lock);
+}
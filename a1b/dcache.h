@@ -0,0 +1,100 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entry lookup cache header file.
+ */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "a1fs.h"
+
+
+/** Default number of entries kept in the lookup cache. */
+#define A1FS_DCACHE_ENTRIES 4096
+
+/** A cached (parent directory inode, name) -> inode mapping. */
+typedef struct dcache_entry {
+	/** Inode number of the directory containing the entry. */
+	a1fs_ino_t parent;
+	/** Inode number the entry refers to. */
+	a1fs_ino_t ino;
+	/** Index of the next entry in the same hash bucket; -1 if none. */
+	int next;
+	/** Whether this slot holds a mapping. */
+	bool valid;
+	/** CLOCK reference bit, set on every hit. */
+	bool referenced;
+	/** Entry name. A null-terminated string. */
+	char name[A1FS_NAME_MAX];
+
+} dcache_entry;
+
+/**
+ * Bounded cache of directory lookups.
+ *
+ * Holds at most a fixed number of entries; when full, a victim is chosen with
+ * the CLOCK (second chance) policy. Safe to use from multiple threads.
+ */
+typedef struct dcache {
+	/** Entry slots. */
+	dcache_entry *entries;
+	/** Number of entry slots. */
+	size_t capacity;
+	/** Hash bucket heads (indices into entries); -1 for an empty bucket. */
+	int *buckets;
+	/** Number of hash buckets (a power of 2). */
+	size_t num_buckets;
+	/** CLOCK hand - the next slot to consider for eviction. */
+	size_t hand;
+	/** Protects all of the above. */
+	pthread_mutex_t lock;
+
+} dcache;
+
+/**
+ * Initialize an empty lookup cache.
+ *
+ * @param dc        pointer to the cache to initialize.
+ * @param capacity  maximum number of entries to keep.
+ * @return          true on success; false if out of memory.
+ */
+bool dcache_init(dcache *dc, size_t capacity);
+
+/** Free all memory held by the cache. */
+void dcache_destroy(dcache *dc);
+
+/**
+ * Look up name in directory parent.
+ *
+ * @param dc      lookup cache.
+ * @param parent  inode number of the directory.
+ * @param name    entry name.
+ * @param ino     pointer to the variable that receives the inode number.
+ * @return        true on a cache hit; false otherwise.
+ */
+bool dcache_lookup(dcache *dc, a1fs_ino_t parent, const char *name, a1fs_ino_t *ino);
+
+/**
+ * Add (or update) the mapping of name in directory parent to inode ino,
+ * evicting another entry if the cache is full.
+ */
+void dcache_insert(dcache *dc, a1fs_ino_t parent, const char *name, a1fs_ino_t ino);
+
+/** Drop the mapping of name in directory parent, if cached. */
+void dcache_remove(dcache *dc, a1fs_ino_t parent, const char *name);
@@ -0,0 +1,438 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entries implementation.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc.h"
+#include "dir.h"
+#include "extent.h"
+
+
+static bool compact_dirs(fs_ctx *fs){
+	return (fs->sb->features & A1FS_FEATURE_COMPACT_DIRS) != 0;
+}
+
+/**
+ * return the name of the entry at byte offset pos of directory
+**/
+static const char *entry_name_at(a1fs_inode *directory, uint64_t pos, fs_ctx *fs){
+	if(compact_dirs(fs)) return ((a1fs_dirent *)get_byte(directory, pos, fs))->name;
+	return ((a1fs_dentry *)get_byte(directory, pos, fs))->name;
+}
+
+/**
+ * return the inode number of the entry at byte offset pos of directory
+**/
+static a1fs_ino_t entry_ino_at(a1fs_inode *directory, uint64_t pos, fs_ctx *fs){
+	if(compact_dirs(fs)) return ((a1fs_dirent *)get_byte(directory, pos, fs))->ino;
+	return ((a1fs_dentry *)get_byte(directory, pos, fs))->ino;
+}
+
+int dir_foreach(a1fs_inode *directory, dir_visit_fn visit, void *arg, fs_ctx *fs){
+	bool compact = compact_dirs(fs);
+	int count = count_extents(directory, fs);
+	//byte offset of the current block within the directory
+	uint64_t block_pos = 0;
+	int ret;
+
+	for(int i = 0; i < count; i++){
+		a1fs_extent extent = *get_extent(directory, i, fs);
+		for(uint64_t j = extent.start; j < (uint64_t)extent.start + extent.count; j++){
+			char *block = get_block(j, fs);
+
+			if(compact){
+				//walk the chain of records covering the block, skipping unused ones
+				for(unsigned int off = 0; off < A1FS_BLOCK_SIZE; off += ((a1fs_dirent *)(block + off))->rec_len){
+					a1fs_dirent *entry = (a1fs_dirent *)(block + off);
+					if(entry->name_len == 0) continue;
+					if((ret = visit(entry->name, entry->ino, block_pos + off, arg)) != 0) return ret;
+				}
+			}else{
+				//the last block may be partially used
+				uint64_t used = directory->size - block_pos;
+				if(used > A1FS_BLOCK_SIZE) used = A1FS_BLOCK_SIZE;
+				a1fs_dentry *entries = (a1fs_dentry *)block;
+				for(unsigned int k = 0; k < used / sizeof(a1fs_dentry); k++){
+					ret = visit(entries[k].name, entries[k].ino, block_pos + k * sizeof(a1fs_dentry), arg);
+					if(ret != 0) return ret;
+				}
+			}
+			block_pos += A1FS_BLOCK_SIZE;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * return the number of slots in the hash index of directory
+**/
+static uint32_t dir_index_size(a1fs_inode *directory){
+	return directory->dir_index_blocks * (A1FS_BLOCK_SIZE / sizeof(a1fs_dir_index_slot));
+}
+
+/**
+ * return pointer to slot i of the hash index of directory
+ * the index blocks need not be next to each other in memory, so each slot is looked
+ * up in its own block
+**/
+static a1fs_dir_index_slot *index_slot(a1fs_inode *directory, uint32_t i, fs_ctx *fs){
+	uint32_t slots_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dir_index_slot);
+	a1fs_dir_index_slot *slots = get_block(directory->dir_index + i / slots_per_block, fs);
+	return &slots[i % slots_per_block];
+}
+
+/**
+ * return the index of the slot in the hash index of directory that refers to the entry
+ * named name, -1 if there is none
+**/
+static int dir_index_find(a1fs_inode *directory, const char *name, fs_ctx *fs){
+	uint32_t mask = dir_index_size(directory) - 1;
+	uint32_t hash = a1fs_name_hash(name);
+
+	//probe until an empty slot; only slots with a matching hash need a name compare
+	for(uint32_t i = hash & mask; index_slot(directory, i, fs)->pos != 0; i = (i + 1) & mask){
+		a1fs_dir_index_slot *slot = index_slot(directory, i, fs);
+		if(slot->hash == hash && strcmp(entry_name_at(directory, slot->pos - 1, fs), name) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * add the entry named name at byte offset pos of directory to its hash index
+ * NOTE: the index must have a free slot
+**/
+static void dir_index_insert(a1fs_inode *directory, const char *name, uint64_t pos, fs_ctx *fs){
+	uint32_t mask = dir_index_size(directory) - 1;
+	uint32_t hash = a1fs_name_hash(name);
+
+	uint32_t i = hash & mask;
+	while(index_slot(directory, i, fs)->pos != 0) i = (i + 1) & mask;
+	a1fs_dir_index_slot *slot = index_slot(directory, i, fs);
+	slot->hash = hash;
+	slot->pos = pos + 1;
+}
+
+/**
+ * remove the entry named name from the hash index of directory
+ * uses backward shift deletion, so probe sequences never need tombstones
+**/
+static void dir_index_delete(a1fs_inode *directory, const char *name, fs_ctx *fs){
+	uint32_t mask = dir_index_size(directory) - 1;
+
+	uint32_t i = dir_index_find(directory, name, fs);
+
+	//move later slots of the same probe sequence back into the hole
+	for(uint32_t j = (i + 1) & mask; index_slot(directory, j, fs)->pos != 0; j = (j + 1) & mask){
+		uint32_t home = index_slot(directory, j, fs)->hash & mask;
+		//slot j stays if its home lies cyclically within (i, j]
+		bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+		if(!stays){
+			*index_slot(directory, i, fs) = *index_slot(directory, j, fs);
+			i = j;
+		}
+	}
+	a1fs_dir_index_slot *slot = index_slot(directory, i, fs);
+	slot->hash = 0;
+	slot->pos = 0;
+}
+
+/**
+ * free the hash index of directory, leaving it with the flat layout only
+**/
+static void dir_index_free(a1fs_inode *directory, fs_ctx *fs){
+	if(directory->dir_index_blocks == 0) return;
+	a1fs_extent index = {.start = directory->dir_index, .count = directory->dir_index_blocks};
+	pthread_mutex_lock(&fs->alloc_lock);
+	deallocate_extent(&index, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	directory->dir_index_blocks = 0;
+}
+
+/** dir_foreach() argument for dir_index_build() **/
+typedef struct index_build_arg {
+	a1fs_inode *directory;
+	fs_ctx *fs;
+} index_build_arg;
+
+static int index_build_visit(const char *name, a1fs_ino_t ino, uint64_t pos, void *arg){
+	(void)ino;
+	index_build_arg *build = arg;
+	dir_index_insert(build->directory, name, pos, build->fs);
+	return 0;
+}
+
+/**
+ * (re)build the hash index of directory from its entries, sized so that it is at
+ * most half full; if no long enough run of free blocks exists the directory is
+ * left without an index and lookups fall back to scanning it
+ * 
+ * @param directory  pointer to inode representing the directory
+ * @param fs         file system context
+ * @return           0 on success, -ENOSPC if the index could not be allocated
+**/
+static int dir_index_build(a1fs_inode *directory, fs_ctx *fs){
+	uint32_t slots_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_dir_index_slot);
+	unsigned int num_blocks = 1;
+	while(num_blocks * slots_per_block < 2 * directory->dir_entries) num_blocks *= 2;
+
+	dir_index_free(directory, fs);
+	a1fs_extent index;
+	if(allocate_contiguous(num_blocks, &index, fs) != 0) return -ENOSPC;
+	directory->dir_index = index.start;
+	directory->dir_index_blocks = num_blocks;
+
+	index_build_arg build = {directory, fs};
+	dir_foreach(directory, index_build_visit, &build, fs);
+	return 0;
+}
+
+
+/** dir_foreach() argument for find_entry() **/
+typedef struct find_arg {
+	const char *name;
+	a1fs_ino_t ino;
+	uint64_t pos;
+} find_arg;
+
+static int find_visit(const char *name, a1fs_ino_t ino, uint64_t pos, void *arg){
+	find_arg *find = arg;
+	if(strcmp(name, find->name) != 0) return 0;
+	find->ino = ino;
+	find->pos = pos;
+	return 1;
+}
+
+int64_t find_entry(a1fs_inode *directory, const char *entry_name, a1fs_ino_t *ino, fs_ctx *fs){
+	//large directories are looked up through their hash index
+	if(directory->dir_index_blocks > 0){
+		int i = dir_index_find(directory, entry_name, fs);
+		if(i == -1) return -ENOENT;
+		uint64_t pos = index_slot(directory, i, fs)->pos - 1;
+		*ino = entry_ino_at(directory, pos, fs);
+		return pos;
+	}
+
+	find_arg find = {entry_name, 0, 0};
+	if(dir_foreach(directory, find_visit, &find, fs) == 0) return -ENOENT;
+	*ino = find.ino;
+	return find.pos;
+}
+
+int get_entry_ino(a1fs_inode *directory, const char *entry_name, a1fs_ino_t *ino, fs_ctx *fs){
+	a1fs_ino_t found;
+	if(dcache_lookup(&fs->dcache, directory->inode_number, entry_name, &found)){
+		*ino = found;
+		return 0;
+	}
+	if(find_entry(directory, entry_name, &found, fs) < 0) return -ENOENT;
+	*ino = found;
+	dcache_insert(&fs->dcache, directory->inode_number, entry_name, found);
+	return 0;
+}
+
+
+/** dir_foreach() argument for get_entry_names() **/
+typedef struct names_arg {
+	char *dest;
+	uint32_t count;
+} names_arg;
+
+static int names_visit(const char *name, a1fs_ino_t ino, uint64_t pos, void *arg){
+	(void)ino;
+	(void)pos;
+	names_arg *names = arg;
+	size_t len = strlen(name) + 1;
+	memcpy(names->dest, name, len);
+	names->dest += len;
+	names->count++;
+	return 0;
+}
+
+char *get_entry_names(a1fs_inode *directory, uint32_t *num_entries, fs_ctx *fs){
+	//every entry takes more room on disk than its name, so size bytes always suffice
+	char *buf = malloc(directory->size + 1);
+	if(buf == NULL) return NULL;
+
+	names_arg names = {buf, 0};
+	dir_foreach(directory, names_visit, &names, fs);
+	*num_entries = names.count;
+	return buf;
+}
+
+
+/**
+ * find room for a compact record of rec_size bytes in directory, growing it by a
+ * block if no existing record has enough slack; the search starts at the block
+ * fs->dir_room points to, which compact_remove() moves back when it frees space,
+ * so that adding an entry stays cheap and deleted entries are still reused
+ * 
+ * @return  byte offset of the record, set up with rec_len and name_len 0,
+ *          -ENOSPC or -ENOMEM if the directory could not grow
+**/
+static int64_t compact_find_room(a1fs_inode *directory, uint16_t rec_size, fs_ctx *fs){
+	uint64_t *room_pos = &fs->dir_room[directory->inode_number];
+	if(*room_pos > directory->size) *room_pos = 0;
+
+	for(uint64_t block_pos = *room_pos; block_pos < directory->size; block_pos += A1FS_BLOCK_SIZE){
+		*room_pos = block_pos;
+		char *block = get_byte(directory, block_pos, fs);
+		for(unsigned int off = 0; off < A1FS_BLOCK_SIZE; off += ((a1fs_dirent *)(block + off))->rec_len){
+			a1fs_dirent *entry = (a1fs_dirent *)(block + off);
+			if(entry->name_len == 0){
+				if(entry->rec_len >= rec_size) return block_pos + off;
+				continue;
+			}
+			//split the slack at the end of a used record off into a new record
+			uint16_t used = a1fs_dirent_size(entry->name_len);
+			if(entry->rec_len - used >= rec_size){
+				a1fs_dirent *room = (a1fs_dirent *)(block + off + used);
+				room->rec_len = entry->rec_len - used;
+				room->name_len = 0;
+				entry->rec_len = used;
+				return block_pos + off + used;
+			}
+		}
+		put_block(block, fs);
+	}
+
+	int error = allocate_blocks(directory, 1, fs);
+	if(error != 0) return error;
+	uint64_t block_pos = directory->size;
+	*room_pos = block_pos;
+	a1fs_dirent *room = get_byte(directory, block_pos, fs);
+	room->rec_len = A1FS_BLOCK_SIZE;
+	room->name_len = 0;
+	directory->size += A1FS_BLOCK_SIZE;
+	return block_pos;
+}
+
+int add_dentry(a1fs_inode *directory, const char *filename, a1fs_inode *inode, fs_ctx *fs){
+	int64_t pos;
+	const char *name;
+
+	if(compact_dirs(fs)){
+		uint16_t name_len = strnlen(filename, A1FS_NAME_MAX - 1);
+		if((pos = compact_find_room(directory, a1fs_dirent_size(name_len), fs)) < 0) return pos;
+		a1fs_dirent *new_entry = get_byte(directory, pos, fs);
+		new_entry->ino = inode->inode_number;
+		new_entry->name_len = name_len;
+		memcpy(new_entry->name, filename, name_len);
+		new_entry->name[name_len] = '\0';
+		name = new_entry->name;
+	}else{
+		//if directory is full, allocate new block for entry
+		if(directory->size % A1FS_BLOCK_SIZE == 0){
+			int error = allocate_blocks(directory, 1, fs);
+			if(error != 0) return error;
+		}
+		//otherwise add entry to last data block
+		a1fs_dentry *new_entry = (a1fs_dentry *)(get_front(directory, fs));
+		pos = directory->size;
+		new_entry->ino = inode->inode_number;
+		strncpy(new_entry->name, filename, A1FS_NAME_MAX);
+		directory->size += sizeof(a1fs_dentry);
+		name = new_entry->name;
+	}
+	directory->dir_entries++;
+	dcache_insert(&fs->dcache, directory->inode_number, name, inode->inode_number);
+
+	//keep the hash index up to date, growing it before it gets 3/4 full,
+	//and switch to the indexed layout once the directory is large enough
+	if(directory->dir_index_blocks > 0){
+		if(4 * directory->dir_entries > 3 * dir_index_size(directory)) dir_index_build(directory, fs);
+		else dir_index_insert(directory, name, pos, fs);
+	}else if(directory->dir_entries >= A1FS_DIR_INDEX_MIN_ENTRIES){
+		dir_index_build(directory, fs);
+	}
+	if((inode->mode & S_IFDIR) == S_IFDIR) directory->links++;
+	return 0;
+}
+
+/**
+ * remove the compact record at byte offset pos of directory by merging it into
+ * the previous record of its block, then drop trailing blocks left empty
+ * the freed space is found again by compact_find_room() through fs->dir_room
+**/
+static void compact_remove(a1fs_inode *directory, uint64_t pos, fs_ctx *fs){
+	uint64_t block_pos = pos - pos % A1FS_BLOCK_SIZE;
+	if(block_pos < fs->dir_room[directory->inode_number]) fs->dir_room[directory->inode_number] = block_pos;
+	char *block = get_byte(directory, block_pos, fs);
+	a1fs_dirent *entry = (a1fs_dirent *)(block + pos % A1FS_BLOCK_SIZE);
+
+	if(entry == (a1fs_dirent *)block){
+		//the first record of a block has nothing to merge into; mark it unused
+		entry->name_len = 0;
+		entry->name[0] = '\0';
+	}else{
+		a1fs_dirent *prev = (a1fs_dirent *)block;
+		while((char *)prev + prev->rec_len != (char *)entry){
+			prev = (a1fs_dirent *)((char *)prev + prev->rec_len);
+		}
+		prev->rec_len += entry->rec_len;
+	}
+
+	while(directory->size > 0){
+		a1fs_dirent *last = get_byte(directory, directory->size - A1FS_BLOCK_SIZE, fs);
+		if(last->name_len != 0 || last->rec_len != A1FS_BLOCK_SIZE) break;
+		deallocate_blocks(directory, 1, fs);
+		directory->size -= A1FS_BLOCK_SIZE;
+	}
+}
+
+/**
+ * remove the fixed size entry at byte offset pos of directory by moving the last
+ * entry into its place
+**/
+static void fixed_remove(a1fs_inode *directory, uint64_t pos, fs_ctx *fs){
+	uint64_t last_pos = directory->size - sizeof(a1fs_dentry);
+	a1fs_dentry *entry = get_byte(directory, pos, fs);
+	a1fs_dentry *last_entry = get_byte(directory, last_pos, fs);
+	if(pos != last_pos){
+		if(directory->dir_index_blocks > 0){
+			index_slot(directory, dir_index_find(directory, last_entry->name, fs), fs)->pos = pos + 1;
+		}
+		memcpy(entry, last_entry, sizeof(a1fs_dentry));
+	}
+	directory->size -= sizeof(a1fs_dentry);
+
+	if(directory->size % A1FS_BLOCK_SIZE == 0){
+		deallocate_blocks(directory, 1, fs);
+	}
+}
+
+void remove_entry(a1fs_inode *directory, const char *name, fs_ctx *fs){
+	a1fs_ino_t ino;
+	int64_t pos = find_entry(directory, name, &ino, fs);
+	if(pos < 0) return;
+
+	dcache_remove(&fs->dcache, directory->inode_number, name);
+	if(directory->dir_index_blocks > 0) dir_index_delete(directory, name, fs);
+	if(compact_dirs(fs)) compact_remove(directory, pos, fs);
+	else fixed_remove(directory, pos, fs);
+
+	directory->dir_entries--;
+	if(directory->dir_entries < A1FS_DIR_INDEX_MIN_ENTRIES / 2){
+		dir_index_free(directory, fs);
+	}
+}
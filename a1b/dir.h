@@ -0,0 +1,89 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Directory entries header file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+//NOTE: directories use either the fixed size a1fs_dentry layout or, if the
+// superblock has A1FS_FEATURE_COMPACT_DIRS, variable length a1fs_dirent
+// records. Entries are identified by their byte offset within the directory,
+// which is also what the hash index of a large directory stores. The caller
+// must hold the directory inode lock (for writing if the directory changes).
+
+/**
+ * callback for dir_foreach(), called for each entry of a directory
+ * 
+ * @param name  entry name
+ * @param ino   inode number the entry refers to
+ * @param pos   byte offset of the entry within the directory
+ * @param arg   the argument given to dir_foreach()
+ * @return      0 to continue, any other value stops the iteration
+**/
+typedef int (*dir_visit_fn)(const char *name, a1fs_ino_t ino, uint64_t pos, void *arg);
+
+/**
+ * call visit for every entry of directory, in on-disk order
+ * 
+ * @return  0 if all entries were visited, otherwise the value returned by visit
+**/
+int dir_foreach(a1fs_inode *directory, dir_visit_fn visit, void *arg, fs_ctx *fs);
+
+/**
+ * look up the entry named entry_name in directory, through its hash index if it has one
+ * 
+ * @param ino  set to the inode number the entry refers to
+ * @return     byte offset of the entry within the directory, -ENOENT if there is none
+**/
+int64_t find_entry(a1fs_inode *directory, const char *entry_name, a1fs_ino_t *ino, fs_ctx *fs);
+
+/**
+ * populate ino with the inode number associated with entry_name in directory
+ * consults the lookup cache first and caches the result of a directory scan
+ * NOTE: the caller must hold the directory lock
+ * return 0 on success, else return -errno
+**/
+int get_entry_ino(a1fs_inode *directory, const char *entry_name, a1fs_ino_t *ino, fs_ctx *fs);
+
+/**
+ * return the names of all entries in directory, stored back to back as
+ * null-terminated strings, and set num_entries to their number
+ * NOTE: the returned buffer must be freed, NULL if out of memory
+**/
+char *get_entry_names(a1fs_inode *directory, uint32_t *num_entries, fs_ctx *fs);
+
+/**
+ * add new directory entry to the directory represented by directory
+ * with name set to filename and ino set to inode_number
+ * 
+ * @param directory     pointer to inode representing the directory
+ * @param filename      name of the entry
+ * @param inode_number  inode number of the inode pointed to by the new entry
+ * @param fs            file system context
+ * @return              0 on success, -ENOSPC or -ENOMEM if the directory could not grow
+**/
+int add_dentry(a1fs_inode *directory, const char *filename, a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * remove the entry named name from directory, releasing blocks it no longer needs
+**/
+void remove_entry(a1fs_inode *directory, const char *name, fs_ctx *fs);
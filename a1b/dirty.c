@@ -0,0 +1,86 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dirty image range tracking implementation.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dirty.h"
+
+
+void dirty_clear(dirty_set *ds)
+{
+	ds->num_ranges = 0;
+}
+
+void dirty_add(dirty_set *ds, a1fs_blk_t start, a1fs_blk_t count)
+{
+	if (count == 0) return;
+
+	// Insert into a copy with room for one more range, absorbing every range
+	// that overlaps or touches the new one
+	dirty_range ranges[A1FS_DIRTY_RANGES + 1];
+	uint32_t n = 0;
+	uint64_t end = (uint64_t)start + count;
+	bool inserted = false;
+	for (uint32_t i = 0; i < ds->num_ranges; i++) {
+		const dirty_range *r = &ds->ranges[i];
+		uint64_t r_end = (uint64_t)r->start + r->count;
+		if (r_end < start) {
+			ranges[n++] = *r;
+		} else if (r->start > end) {
+			if (!inserted) {
+				ranges[n++] = (dirty_range){start, end - start};
+				inserted = true;
+			}
+			ranges[n++] = *r;
+		} else {
+			if (r->start < start) start = r->start;
+			if (r_end > end) end = r_end;
+		}
+	}
+	if (!inserted) ranges[n++] = (dirty_range){start, end - start};
+
+	// Over the limit; merge the two neighbours closest to each other
+	if (n > A1FS_DIRTY_RANGES) {
+		uint32_t best = 0;
+		uint64_t best_gap = UINT64_MAX;
+		for (uint32_t i = 0; i + 1 < n; i++) {
+			uint64_t gap = ranges[i + 1].start - (ranges[i].start + ranges[i].count);
+			if (gap < best_gap) {
+				best = i;
+				best_gap = gap;
+			}
+		}
+		ranges[best].count = ranges[best + 1].start + ranges[best + 1].count - ranges[best].start;
+		memmove(&ranges[best + 1], &ranges[best + 2], (n - best - 2) * sizeof(dirty_range));
+		n--;
+	}
+
+	memcpy(ds->ranges, ranges, n * sizeof(dirty_range));
+	ds->num_ranges = n;
+}
+
+int dirty_sync(const dirty_set *ds, bdev *dev)
+{
+	for (uint32_t i = 0; i < ds->num_ranges; i++) {
+		int ret = bdev_writeback(dev, ds->ranges[i].start, ds->ranges[i].count);
+		if (ret != 0) return ret;
+	}
+	return bdev_flush(dev);
+}
@@ -0,0 +1,67 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Dirty image range tracking header file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "bdev.h"
+
+
+/** Number of separate ranges a dirty set keeps before it merges the closest ones. */
+#define A1FS_DIRTY_RANGES 8
+
+/** A run of image blocks. */
+typedef struct dirty_range {
+	/** First block (from the start of the image). */
+	a1fs_blk_t start;
+	/** Number of blocks. */
+	a1fs_blk_t count;
+
+} dirty_range;
+
+/**
+ * Set of image blocks that have been modified since they were last flushed.
+ *
+ * Kept as a few disjoint ranges sorted by start block. When a new range would
+ * exceed A1FS_DIRTY_RANGES, the two ranges with the smallest gap between them
+ * are merged, so the set may also cover some clean blocks. Not thread safe.
+ */
+typedef struct dirty_set {
+	/** Number of ranges in use. */
+	uint32_t num_ranges;
+	dirty_range ranges[A1FS_DIRTY_RANGES];
+
+} dirty_set;
+
+/** Empty the set. */
+void dirty_clear(dirty_set *ds);
+
+/** Add count blocks starting at image block start to the set. */
+void dirty_add(dirty_set *ds, a1fs_blk_t start, a1fs_blk_t count);
+
+/**
+ * Write the blocks of the set back to the image file and wait for them to reach
+ * the disk. The set is not changed.
+ *
+ * @param ds   dirty set.
+ * @param dev  the image.
+ * @return     0 on success; -errno on failure.
+ */
+int dirty_sync(const dirty_set *ds, bdev *dev);
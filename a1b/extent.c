@@ -0,0 +1,618 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent map implementation.
+ */
+
+#include <string.h>
+
+#include "alloc.h"
+#include "extent.h"
+
+
+static bool is_tree(a1fs_inode *inode, fs_ctx *fs)
+{
+	return (fs->sb->features & A1FS_FEATURE_EXTENT_TREE) && (inode->flags & A1FS_INODE_EXTENT_TREE);
+}
+
+bool has_extent_slots(a1fs_inode *inode, fs_ctx *fs)
+{
+	//NOTE: without inline data the flags may be left over padding of an older image
+	return inline_capacity(fs) > 0 && (inode->flags & A1FS_INODE_INLINE_EXTENTS);
+}
+
+// Number of extents that fit in an inode
+static int slot_count(fs_ctx *fs)
+{
+	return inline_capacity(fs) / sizeof(a1fs_extent);
+}
+
+// The extent array of a file that has no extent tree
+static a1fs_extent *plain_extents(a1fs_inode *inode, fs_ctx *fs)
+{
+	if (has_extent_slots(inode, fs)) return (a1fs_extent *)get_inline_data(inode);
+	return get_block(inode->extents, fs);
+}
+
+static void put_plain_extents(a1fs_inode *inode, a1fs_extent *extents, fs_ctx *fs)
+{
+	if (!has_extent_slots(inode, fs)) put_block(extents, fs);
+}
+
+// Number of extents that fit in the extent array of a file that has no extent tree
+static int plain_capacity(a1fs_inode *inode, fs_ctx *fs)
+{
+	return has_extent_slots(inode, fs) ? slot_count(fs) : A1FS_BLOCK_EXTENTS;
+}
+
+static a1fs_extent_node *get_node(a1fs_blk_t block, fs_ctx *fs)
+{
+	return get_block(block, fs);
+}
+
+static a1fs_extent *leaf_extents(a1fs_extent_node *node)
+{
+	return (a1fs_extent *)(node + 1);
+}
+
+static a1fs_extent_index *node_index(a1fs_extent_node *node)
+{
+	return (a1fs_extent_index *)(node + 1);
+}
+
+// Entry p of a node, of either kind
+static char *node_entry(a1fs_extent_node *node, int p)
+{
+	return (char *)(node + 1) + p * sizeof(a1fs_extent);
+}
+
+// Lowest lblk in the subtree at node
+static a1fs_blk_t first_key(a1fs_extent_node *node)
+{
+	return (node->depth == 0) ? leaf_extents(node)[0].lblk : node_index(node)[0].lblk;
+}
+
+// Number of the count extents (sorted by lblk) that start at or before block_index
+static int search_extents(const a1fs_extent *extents, int count, uint64_t block_index)
+{
+	int low = 0;
+	int high = count;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		if (extents[mid].lblk <= block_index) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+// Entry of an index node whose subtree holds extent number i of the node
+static int child_holding(a1fs_extent_node *node, int i)
+{
+	a1fs_extent_index *index = node_index(node);
+	// The first entry always starts at 0
+	int low = 1;
+	int high = node->entries;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		if (index[mid].first <= (uint32_t)i) low = mid + 1;
+		else high = mid;
+	}
+	return low - 1;
+}
+
+// Last entry of an index node with lblk at or before block_index; -1 if none
+static int child_before(a1fs_extent_node *node, uint64_t block_index)
+{
+	a1fs_extent_index *index = node_index(node);
+	int low = 0;
+	int high = node->entries;
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+		if (index[mid].lblk <= block_index) low = mid + 1;
+		else high = mid;
+	}
+	return low - 1;
+}
+
+int count_extents(a1fs_inode *inode, fs_ctx *fs)
+{
+	if (!is_tree(inode, fs)) return inode->num_extents;
+	a1fs_extent_node *root = get_node(inode->extents, fs);
+	int count = root->extents;
+	put_block(root, fs);
+	return count;
+}
+
+a1fs_extent *get_extent(a1fs_inode *inode, int i, fs_ctx *fs)
+{
+	if (!is_tree(inode, fs)) return plain_extents(inode, fs) + i;
+
+	a1fs_extent_node *node = get_node(inode->extents, fs);
+	while (node->depth > 0) {
+		a1fs_extent_index *entry = &node_index(node)[child_holding(node, i)];
+		i -= entry->first;
+		a1fs_blk_t child = entry->block;
+		put_block(node, fs);
+		node = get_node(child, fs);
+	}
+	return leaf_extents(node) + i;
+}
+
+void put_extent(a1fs_inode *inode, a1fs_extent *extent, fs_ctx *fs)
+{
+	// Extents in the inode come with the inode block, which the caller holds
+	if (!has_extent_slots(inode, fs)) put_block(extent, fs);
+}
+
+int count_extents_before(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs)
+{
+	if (!is_tree(inode, fs)) {
+		if (inode->num_extents == 0) return 0;
+		a1fs_extent *extents = plain_extents(inode, fs);
+		int count = search_extents(extents, inode->num_extents, block_index);
+		put_plain_extents(inode, extents, fs);
+		return count;
+	}
+
+	int count = 0;
+	a1fs_extent_node *node = get_node(inode->extents, fs);
+	while (node->depth > 0) {
+		int j = child_before(node, block_index);
+		if (j < 0) {
+			put_block(node, fs);
+			return count;
+		}
+		a1fs_extent_index *entry = &node_index(node)[j];
+		count += entry->first;
+		a1fs_blk_t child = entry->block;
+		put_block(node, fs);
+		node = get_node(child, fs);
+	}
+	count += search_extents(leaf_extents(node), node->entries, block_index);
+	put_block(node, fs);
+	return count;
+}
+
+// Allocate a block for the extent map of a file, preferably at goal, out of the blocks
+// make_extent_room() set aside for it
+static a1fs_blk_t take_block(a1fs_inode *inode, a1fs_blk_t goal, fs_ctx *fs)
+{
+	a1fs_extent block = {0};
+	pthread_mutex_lock(&fs->alloc_lock);
+	freemap_search_goal(&fs->freemap, goal, 1, 0, &block);
+	allocate_bit('d', block.start, fs);
+	if (fs->map_room[inode->inode_number] > 0) {
+		fs->map_room[inode->inode_number]--;
+		fs->map_reserved--;
+	}
+	pthread_mutex_unlock(&fs->alloc_lock);
+	inode->blocks++;
+	return block.start;
+}
+
+// Free a block of the extent map of a file
+static void drop_block(a1fs_inode *inode, a1fs_blk_t block, fs_ctx *fs)
+{
+	pthread_mutex_lock(&fs->alloc_lock);
+	deallocate_bit('d', block, fs);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	inode->blocks--;
+}
+
+// Allocate an empty node of an extent tree, preferably at goal
+static a1fs_extent_node *new_node(a1fs_inode *inode, uint16_t depth, a1fs_blk_t goal, a1fs_blk_t *block,
+                                  fs_ctx *fs)
+{
+	*block = take_block(inode, goal, fs);
+	a1fs_extent_node *node = get_node(*block, fs);
+	memset(node, 0, A1FS_BLOCK_SIZE);
+	node->depth = depth;
+	return node;
+}
+
+// Number of free blocks the extent map of a file may need to grow by count extents
+static uint64_t blocks_to_grow(a1fs_inode *inode, int count, fs_ctx *fs)
+{
+	if (is_tree(inode, fs)) {
+		a1fs_extent_node *root = get_node(inode->extents, fs);
+		uint64_t depth = root->depth;
+		put_block(root, fs);
+		// Each extent may split a node on every level and add a new root
+		return count * (depth + 2);
+	}
+
+	int needed = inode->num_extents + count;
+	uint64_t blocks = 0;
+	int capacity = plain_capacity(inode, fs);
+	if (inode->extents == -1 && !has_extent_slots(inode, fs)) {
+		// A new map starts in the inode if it has room, otherwise in a block
+		if (slot_count(fs) > 0) capacity = slot_count(fs);
+		else blocks = 1;
+	}
+	if (needed <= capacity) return blocks;
+	if (capacity < A1FS_BLOCK_EXTENTS) {
+		blocks++;
+		if (needed <= A1FS_BLOCK_EXTENTS) return blocks;
+	}
+	if (!(fs->sb->features & A1FS_FEATURE_EXTENT_TREE)) return UINT64_MAX;
+	// Two leaves, then the inserts into a tree of depth 1
+	return blocks + 2 + count * 3;
+}
+
+// Move the extents of a file from its inode to a block of their own
+static void move_to_block(a1fs_inode *inode, fs_ctx *fs)
+{
+	a1fs_blk_t block = take_block(inode, inode_goal(inode, fs), fs);
+	a1fs_extent *extents = get_block(block, fs);
+	memcpy(extents, get_inline_data(inode), inode->num_extents * sizeof(a1fs_extent));
+	put_block(extents, fs);
+	inode->flags &= ~A1FS_INODE_INLINE_EXTENTS;
+	inode->extents = block;
+}
+
+// Move the extents of a file from their block back into its inode
+static void move_to_slots(a1fs_inode *inode, fs_ctx *fs)
+{
+	a1fs_extent *extents = get_block(inode->extents, fs);
+	memcpy(get_inline_data(inode), extents, inode->num_extents * sizeof(a1fs_extent));
+	put_block(extents, fs);
+	drop_block(inode, inode->extents, fs);
+	inode->extents = -1;
+	inode->flags |= A1FS_INODE_INLINE_EXTENTS;
+}
+
+// Turn the extent block of a file into two leaves under a new root
+static void make_tree(a1fs_inode *inode, fs_ctx *fs)
+{
+	a1fs_extent *extents = get_block(inode->extents, fs);
+	int count = inode->num_extents;
+	a1fs_extent_index index[2] = {0};
+	for (int j = 0; j < 2; j++) {
+		int first = j * count / 2;
+		int n = (j + 1) * count / 2 - first;
+		a1fs_extent_node *leaf = new_node(inode, 0, inode->extents + 1, &index[j].block, fs);
+		memcpy(leaf_extents(leaf), extents + first, n * sizeof(a1fs_extent));
+		leaf->entries = n;
+		leaf->extents = n;
+		put_block(leaf, fs);
+		index[j].lblk = extents[first].lblk;
+		index[j].first = first;
+	}
+
+	// The extent block becomes the root
+	a1fs_extent_node *root = (a1fs_extent_node *)extents;
+	memset(root, 0, A1FS_BLOCK_SIZE);
+	root->depth = 1;
+	root->entries = 2;
+	root->extents = count;
+	memcpy(node_index(root), index, sizeof(index));
+	put_block(root, fs);
+	inode->num_extents = 0;
+	inode->flags |= A1FS_INODE_EXTENT_TREE;
+}
+
+bool make_extent_room(a1fs_inode *inode, int count, fs_ctx *fs)
+{
+	// Set the blocks aside, so that the data of other files can't take them before
+	// a node split in the middle of an insert needs them
+	uint64_t blocks = blocks_to_grow(inode, count, fs);
+	if (blocks != 0) {
+		pthread_mutex_lock(&fs->alloc_lock);
+		bool enough = (blocks <= unreserved_blocks(fs));
+		if (enough) {
+			fs->map_reserved += blocks;
+			fs->map_room[inode->inode_number] += blocks;
+		}
+		pthread_mutex_unlock(&fs->alloc_lock);
+		if (!enough) return false;
+	}
+	if (is_tree(inode, fs)) return true;
+
+	if (inode->extents == -1 && !has_extent_slots(inode, fs)) {
+		if (slot_count(fs) > 0) inode->flags |= A1FS_INODE_INLINE_EXTENTS;
+		else inode->extents = take_block(inode, inode_goal(inode, fs), fs);
+	}
+	int needed = inode->num_extents + count;
+	if (needed > plain_capacity(inode, fs) && has_extent_slots(inode, fs)) move_to_block(inode, fs);
+	if (needed > A1FS_BLOCK_EXTENTS) make_tree(inode, fs);
+	return true;
+}
+
+// Move the upper half of the entries of the full node at block to a new node, and
+// set *split to the entry for the new node, but for its lblk
+static a1fs_extent_node *split_node(a1fs_inode *inode, a1fs_extent_node *node, a1fs_blk_t block,
+                                    a1fs_extent_index *split, fs_ctx *fs)
+{
+	a1fs_extent_node *right = new_node(inode, node->depth, block + 1, &block, fs);
+	int keep = node->entries / 2;
+	right->entries = node->entries - keep;
+	memcpy(node_entry(right, 0), node_entry(node, keep), right->entries * sizeof(a1fs_extent));
+	node->entries = keep;
+
+	uint32_t left_extents = keep;
+	if (node->depth > 0) {
+		a1fs_extent_index *index = node_index(right);
+		left_extents = index[0].first;
+		for (int j = 0; j < right->entries; j++) index[j].first -= left_extents;
+	}
+	right->extents = node->extents - left_extents;
+	node->extents = left_extents;
+	*split = (a1fs_extent_index){.block = block};
+	return right;
+}
+
+// Insert entry at position p of the node at block, splitting the node first if it is full.
+// Return whether it was split, setting *split to the entry for the new node.
+// The extents under a new index entry must already be counted in the node.
+static bool add_entry(a1fs_inode *inode, a1fs_extent_node *node, a1fs_blk_t block, int p,
+                      const void *entry, a1fs_extent_index *split, fs_ctx *fs)
+{
+	a1fs_extent_node *target = node;
+	a1fs_extent_node *right = NULL;
+	if (node->entries == A1FS_NODE_ENTRIES) {
+		right = split_node(inode, node, block, split, fs);
+		if (p > node->entries) {
+			p -= node->entries;
+			target = right;
+		}
+	}
+
+	memmove(node_entry(target, p + 1), node_entry(target, p), (target->entries - p) * sizeof(a1fs_extent));
+	memcpy(node_entry(target, p), entry, sizeof(a1fs_extent));
+	target->entries++;
+	if (target->depth == 0) {
+		target->extents++;
+	} else if (target == right) {
+		// The extents before the entry now count from the start of the new node
+		node_index(target)[p].first -= node->extents;
+	}
+
+	if (right == NULL) return false;
+	split->lblk = first_key(right);
+	split->first = node->extents;
+	put_block(right, fs);
+	return true;
+}
+
+// Insert extent as number i of the subtree at block. Return whether the root of the
+// subtree was split, setting *split to the entry for the new node.
+static bool node_insert(a1fs_inode *inode, a1fs_blk_t block, int i, const a1fs_extent *extent,
+                        a1fs_extent_index *split, fs_ctx *fs)
+{
+	a1fs_extent_node *node = get_node(block, fs);
+	bool was_split;
+	if (node->depth == 0) {
+		was_split = add_entry(inode, node, block, i, extent, split, fs);
+	} else {
+		a1fs_extent_index *index = node_index(node);
+		int j = child_holding(node, i);
+		if (extent->lblk < index[j].lblk) index[j].lblk = extent->lblk;
+
+		a1fs_extent_index child_split;
+		bool child_was_split = node_insert(inode, index[j].block, i - index[j].first, extent,
+		                                   &child_split, fs);
+		for (int k = j + 1; k < node->entries; k++) index[k].first++;
+		node->extents++;
+
+		was_split = false;
+		if (child_was_split) {
+			child_split.first += index[j].first;
+			was_split = add_entry(inode, node, block, j + 1, &child_split, split, fs);
+		}
+	}
+	put_block(node, fs);
+	return was_split;
+}
+
+static void tree_insert(a1fs_inode *inode, int i, const a1fs_extent *extent, fs_ctx *fs)
+{
+	a1fs_extent_index split;
+	if (!node_insert(inode, inode->extents, i, extent, &split, fs)) return;
+
+	// The root was split; add a level above it
+	a1fs_extent_node *left = get_node(inode->extents, fs);
+	a1fs_extent_node *right = get_node(split.block, fs);
+	a1fs_blk_t block;
+	a1fs_extent_node *root = new_node(inode, left->depth + 1, inode->extents + 1, &block, fs);
+	a1fs_extent_index *index = node_index(root);
+	index[0] = (a1fs_extent_index){.lblk = first_key(left), .block = inode->extents};
+	index[1] = split;
+	root->entries = 2;
+	root->extents = left->extents + right->extents;
+	put_block(root, fs);
+	put_block(right, fs);
+	put_block(left, fs);
+	inode->extents = block;
+}
+
+// Insert an extent into a map that make_extent_room() made room in
+static void insert_extent(a1fs_inode *inode, int i, const a1fs_extent *extent, fs_ctx *fs)
+{
+	if (is_tree(inode, fs)) {
+		tree_insert(inode, i, extent, fs);
+		return;
+	}
+
+	a1fs_extent *extents = plain_extents(inode, fs);
+	memmove(&extents[i + 1], &extents[i], (inode->num_extents - i) * sizeof(a1fs_extent));
+	extents[i] = *extent;
+	inode->num_extents++;
+	put_plain_extents(inode, extents, fs);
+}
+
+void release_extent_room(a1fs_inode *inode, fs_ctx *fs)
+{
+	if (fs->map_room[inode->inode_number] == 0) return;
+	pthread_mutex_lock(&fs->alloc_lock);
+	fs->map_reserved -= fs->map_room[inode->inode_number];
+	fs->map_room[inode->inode_number] = 0;
+	pthread_mutex_unlock(&fs->alloc_lock);
+}
+
+bool insert_extents(a1fs_inode *inode, int i, const a1fs_extent *extents, int count, fs_ctx *fs)
+{
+	if (!make_extent_room(inode, count, fs)) return false;
+	for (int k = 0; k < count; k++) insert_extent(inode, i + k, &extents[k], fs);
+	release_extent_room(inode, fs);
+	return true;
+}
+
+// Remove extent number i of the subtree at block; return whether the subtree is left
+// empty, in which case the caller frees the block
+static bool node_remove(a1fs_inode *inode, a1fs_blk_t block, int i, fs_ctx *fs)
+{
+	a1fs_extent_node *node = get_node(block, fs);
+	int p = i;
+	if (node->depth > 0) {
+		a1fs_extent_index *index = node_index(node);
+		p = child_holding(node, i);
+		bool emptied = node_remove(inode, index[p].block, i - index[p].first, fs);
+		for (int k = p + 1; k < node->entries; k++) index[k].first--;
+		if (emptied) drop_block(inode, index[p].block, fs);
+		else p = -1;
+	}
+	if (p >= 0) {
+		memmove(node_entry(node, p), node_entry(node, p + 1), (node->entries - p - 1) * sizeof(a1fs_extent));
+		node->entries--;
+	}
+	node->extents--;
+	bool empty = (node->entries == 0);
+	put_block(node, fs);
+	return empty;
+}
+
+static void tree_remove(a1fs_inode *inode, int i, fs_ctx *fs)
+{
+	if (node_remove(inode, inode->extents, i, fs)) {
+		// That was the last extent
+		drop_block(inode, inode->extents, fs);
+		inode->extents = -1;
+		inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+		return;
+	}
+
+	// Drop roots left with a single child; a single leaf becomes an extent block again
+	for (;;) {
+		a1fs_extent_node *root = get_node(inode->extents, fs);
+		a1fs_blk_t child = node_index(root)[0].block;
+		bool single = (root->entries == 1);
+		put_block(root, fs);
+		if (!single) return;
+
+		drop_block(inode, inode->extents, fs);
+		inode->extents = child;
+		a1fs_extent_node *node = get_node(child, fs);
+		if (node->depth == 0) {
+			inode->num_extents = node->entries;
+			memmove(node, leaf_extents(node), node->entries * sizeof(a1fs_extent));
+			put_block(node, fs);
+			inode->flags &= ~A1FS_INODE_EXTENT_TREE;
+			return;
+		}
+		put_block(node, fs);
+	}
+}
+
+static void remove_extent(a1fs_inode *inode, int i, fs_ctx *fs)
+{
+	if (is_tree(inode, fs)) {
+		tree_remove(inode, i, fs);
+		return;
+	}
+
+	a1fs_extent *extents = plain_extents(inode, fs);
+	memmove(&extents[i], &extents[i + 1], (inode->num_extents - i - 1) * sizeof(a1fs_extent));
+	inode->num_extents--;
+	put_plain_extents(inode, extents, fs);
+
+	// Back into the inode once they fit there with room to spare, so that a file at
+	// the limit does not move its extents back and forth
+	if (!has_extent_slots(inode, fs) && inode->extents != -1 && inode->num_extents <= slot_count(fs) / 2) {
+		move_to_slots(inode, fs);
+	}
+}
+
+void remove_extents(a1fs_inode *inode, int i, int count, fs_ctx *fs)
+{
+	for (int k = 0; k < count; k++) remove_extent(inode, i, fs);
+}
+
+// Call visit on the blocks of all nodes of the extent tree at block, children first,
+// without reading the leaves
+static void walk_nodes(a1fs_blk_t block, void (*visit)(a1fs_blk_t block, void *arg), void *arg,
+                       fs_ctx *fs)
+{
+	a1fs_extent_node *node = get_node(block, fs);
+	a1fs_extent_index *index = node_index(node);
+	for (int j = 0; j < node->entries; j++) {
+		if (node->depth > 1) walk_nodes(index[j].block, visit, arg, fs);
+		else visit(index[j].block, arg);
+	}
+	put_block(node, fs);
+	visit(block, arg);
+}
+
+static void count_node(a1fs_blk_t block, void *arg)
+{
+	(void)block;
+	(*(uint64_t *)arg)++;
+}
+
+uint64_t extent_map_blocks(a1fs_inode *inode, fs_ctx *fs)
+{
+	if (!is_tree(inode, fs)) return (inode->extents != -1) ? 1 : 0;
+	uint64_t count = 0;
+	walk_nodes(inode->extents, count_node, &count, fs);
+	return count;
+}
+
+typedef struct dirty_nodes {
+	dirty_set *set;
+	a1fs_blk_t first_data_block;
+} dirty_nodes;
+
+static void dirty_node(a1fs_blk_t block, void *arg)
+{
+	dirty_nodes *d = (dirty_nodes *)arg;
+	dirty_add(d->set, (uint64_t)d->first_data_block + block, 1);
+}
+
+void dirty_extent_map(a1fs_inode *inode, dirty_set *set, fs_ctx *fs)
+{
+	dirty_nodes d = {set, fs->sb->first_data_block};
+	if (is_tree(inode, fs)) walk_nodes(inode->extents, dirty_node, &d, fs);
+	else if (inode->extents != -1) dirty_node(inode->extents, &d);
+}
+
+typedef struct free_nodes {
+	a1fs_inode *inode;
+	fs_ctx *fs;
+} free_nodes;
+
+static void free_node(a1fs_blk_t block, void *arg)
+{
+	free_nodes *f = (free_nodes *)arg;
+	drop_block(f->inode, block, f->fs);
+}
+
+void free_extent_map(a1fs_inode *inode, fs_ctx *fs)
+{
+	free_nodes f = {inode, fs};
+	if (is_tree(inode, fs)) walk_nodes(inode->extents, free_node, &f, fs);
+	else if (inode->extents != -1) drop_block(inode, inode->extents, fs);
+	inode->extents = -1;
+	inode->num_extents = 0;
+	inode->flags &= ~(A1FS_INODE_EXTENT_TREE | A1FS_INODE_INLINE_EXTENTS);
+}
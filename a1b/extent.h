@@ -0,0 +1,129 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Extent map header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+#include "dirty.h"
+#include "fs_ctx.h"
+
+
+//NOTE: the extents of a file are numbered from 0 in lblk order and kept in the
+// cheapest form that holds them: in the inode (A1FS_INODE_INLINE_EXTENTS), in
+// one extent block, or in a B+tree of blocks (A1FS_INODE_EXTENT_TREE) once a
+// block is not enough. The map changes form by itself as extents are inserted
+// and removed. Index nodes count the extents under each entry, so the extent
+// with a given number and the extent holding a given file block are both found
+// in O(log n) by walking down from the root.
+//
+// Pointers returned by get_extent() stay valid until the next insert_extents()
+// or remove_extents() on the same file. The fields of an extent may be changed
+// through them, except that its lblk may only grow, and not past the lblk of
+// the extent after it.
+
+/** Number of extents in an extent block, which has no header. */
+#define A1FS_BLOCK_EXTENTS (int)(A1FS_BLOCK_SIZE / sizeof(a1fs_extent))
+
+/** Number of entries in a node of an extent tree. */
+#define A1FS_NODE_ENTRIES \
+	(int)((A1FS_BLOCK_SIZE - sizeof(a1fs_extent_node)) / sizeof(a1fs_extent))
+
+/** Whether the extents of inode are stored in the inode. */
+bool has_extent_slots(a1fs_inode *inode, fs_ctx *fs);
+
+/** Number of extents of the file represented by inode. */
+int count_extents(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * Get an extent of a file.
+ *
+ * @param inode  pointer to the inode of the file.
+ * @param i      number of the extent, less than count_extents().
+ * @param fs     file system context.
+ * @return       pointer to the extent.
+ */
+a1fs_extent *get_extent(a1fs_inode *inode, int i, fs_ctx *fs);
+
+/**
+ * Give back the block holding an extent got with get_extent() before the end of
+ * the operation, e.g. in loops over all the extents of a file or on threads
+ * that do not run file system operations (see fs_ctx.h).
+ */
+void put_extent(a1fs_inode *inode, a1fs_extent *extent, fs_ctx *fs);
+
+/** Number of extents of the file represented by inode starting at or before block block_index. */
+int count_extents_before(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs);
+
+/**
+ * Make room for count more extents in the extent map of a file: give the file a
+ * map if it has none, and move the map to a larger form if it is too small.
+ * Doing this before allocating the blocks of the new extents keeps the blocks
+ * the map takes from landing right after them, where the file would grow.
+ * The blocks the map may still need are set aside (fs->map_reserved) until
+ * release_extent_room(), which insert_extents() calls once it is done.
+ * Must be called with the inode locked for writing, and without fs->alloc_lock,
+ * which it takes itself.
+ *
+ * @return  true on success; false if there are not enough free blocks for the
+ *          map to grow into (or, without A1FS_FEATURE_EXTENT_TREE, the file
+ *          would need more extents than fit in a block).
+ */
+bool make_extent_room(a1fs_inode *inode, int count, fs_ctx *fs);
+
+/**
+ * Give back the free blocks make_extent_room() set aside for the extent map of
+ * the file represented by inode and that the map did not take.
+ */
+void release_extent_room(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * Insert extents into the extent map of a file, growing the map as needed.
+ * Must be called with the inode locked for writing, and without fs->alloc_lock.
+ *
+ * @param inode    pointer to the inode of the file.
+ * @param i        number the first new extent gets; the extents from i on move up.
+ * @param extents  the new extents, in order; they must keep the map sorted.
+ * @param count    number of new extents.
+ * @param fs       file system context.
+ * @return         true on success; false (with nothing inserted) if there is
+ *                 no room (see make_extent_room()).
+ */
+bool insert_extents(a1fs_inode *inode, int i, const a1fs_extent *extents, int count, fs_ctx *fs);
+
+/**
+ * Remove count extents starting at number i from the extent map of a file,
+ * shrinking the map as it empties. The blocks of the extents are not freed.
+ * Must be called with the inode locked for writing, and without fs->alloc_lock.
+ */
+void remove_extents(a1fs_inode *inode, int i, int count, fs_ctx *fs);
+
+/** Number of blocks taken by the extent map of the file represented by inode. */
+uint64_t extent_map_blocks(a1fs_inode *inode, fs_ctx *fs);
+
+/** Add the blocks of the extent map of the file represented by inode to set. */
+void dirty_extent_map(a1fs_inode *inode, dirty_set *set, fs_ctx *fs);
+
+/**
+ * Free the blocks of the extent map of the file represented by inode, leaving it
+ * with no extents. The blocks of the extents are not freed.
+ * Must be called with the inode locked for writing, and without fs->alloc_lock.
+ */
+void free_extent_map(a1fs_inode *inode, fs_ctx *fs);
@@ -0,0 +1,635 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File operations shared by the FUSE drivers implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/falloc.h>
+
+// Using 2.9.x FUSE API
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+
+#include "alloc.h"
+#include "dir.h"
+#include "extent.h"
+#include "file.h"
+#include "flush.h"
+
+
+/**
+ * return the number of data blocks owned by the file represented by inode, including
+ * the blocks of its extent map and directory index; holes in the file take no blocks
+ * the inode keeps the count, but images without A1FS_FEATURE_BLOCK_COUNT need a walk
+**/
+static uint64_t count_blocks(a1fs_inode *inode, fs_ctx *fs){
+	if(fs->sb->features & A1FS_FEATURE_BLOCK_COUNT) return inode->dir_index_blocks + inode->blocks;
+
+	uint64_t blocks = inode->dir_index_blocks + extent_map_blocks(inode, fs);
+	int count = count_extents(inode, fs);
+	for(int i = 0; i < count; i++){
+		blocks += get_extent(inode, i, fs)->count;
+	}
+	return blocks;
+}
+
+/**
+ * find where the part of a read of size bytes at offset of the file represented by
+ * inode that lies in one extent or one hole is stored
+ * return the number of bytes of the part, and set src to where they are in the image,
+ * or to NULL if they are in a hole or an unwritten extent and read as zeros
+ * hint is the extent cursor for find_extent_near()
+ * NOTE: the range must lie within the file
+**/
+static size_t read_run(a1fs_inode *inode, size_t size, uint64_t offset, char **src, int *hint, fs_ctx *fs){
+	if(is_inline(inode, fs)){
+		*src = get_inline_data(inode) + offset;
+		return size;
+	}
+	uint64_t block_index = offset / A1FS_BLOCK_SIZE;
+	uint64_t offset_in_block = offset % A1FS_BLOCK_SIZE;
+	int i = find_extent_near(inode, block_index, hint, fs);
+	if(i == -1){
+		//a hole, up to the next extent
+		int next = find_extent_after(inode, block_index, fs);
+		*src = NULL;
+		if(next == count_extents(inode, fs)) return size;
+		uint64_t hole = (get_extent(inode, next, fs)->lblk - block_index) * A1FS_BLOCK_SIZE;
+		return (hole - offset_in_block < size) ? hole - offset_in_block : size;
+	}
+	a1fs_extent *extent = get_extent(inode, i, fs);
+	uint64_t run = mapped_run((uint64_t)extent->lblk + extent->count - block_index, fs);
+	size_t n = run * A1FS_BLOCK_SIZE - offset_in_block;
+	if(n > size) n = size;
+	if(extent->flags & A1FS_EXTENT_UNWRITTEN){
+		*src = NULL;
+	}else{
+		*src = (char *)get_block(extent->start + (block_index - extent->lblk), fs) + offset_in_block;
+	}
+	return n;
+}
+
+/**
+ * copy size bytes of the file represented by inode starting at offset into buf,
+ * one extent at a time; holes and unwritten extents read as zeros
+ * NOTE: the range must lie within the file
+**/
+static void read_file_data(a1fs_inode *inode, char *buf, size_t size, uint64_t offset, int *hint, fs_ctx *fs){
+	while(size > 0){
+		char *src;
+		size_t n = read_run(inode, size, offset, &src, hint, fs);
+		if(src == NULL){
+			memset(buf, 0, n);
+		}else{
+			memcpy(buf, src, n);
+		}
+		buf += n;
+		offset += n;
+		size -= n;
+	}
+}
+
+/**
+ * get the part of a write of size bytes at offset of the file represented by inode that
+ * lies in one extent ready to be stored: unwritten blocks are zeroed around the new data
+ * and marked written
+ * return the number of bytes of the part, and set dest to where they go in the image
+ * NOTE: the range must lie within the file and all of its blocks must be allocated; the
+ * caller must store all of the bytes before the file is read again
+**/
+static size_t write_run(a1fs_inode *inode, size_t size, uint64_t offset, char **dest, int *hint, fs_ctx *fs){
+	//inline data is written back with the inode
+	if(is_inline(inode, fs)){
+		*dest = get_inline_data(inode) + offset;
+		return size;
+	}
+	uint64_t block_index = offset / A1FS_BLOCK_SIZE;
+	int i = find_extent_near(inode, block_index, hint, fs);
+	a1fs_extent *extent = get_extent(inode, i, fs);
+	uint64_t offset_in_block = offset % A1FS_BLOCK_SIZE;
+	uint64_t run = mapped_run((uint64_t)extent->lblk + extent->count - block_index, fs);
+	size_t n = run * A1FS_BLOCK_SIZE - offset_in_block;
+	if(n > size) n = size;
+	a1fs_blk_t block = extent->start + (block_index - extent->lblk);
+	*dest = (char *)get_block(block, fs) + offset_in_block;
+	mark_dirty(inode, block, (offset_in_block + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE, fs);
+
+	if(extent->flags & A1FS_EXTENT_UNWRITTEN){
+		//the parts of the first and last block around the data must read as zeros
+		uint64_t count = (offset_in_block + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		uint64_t end_in_block = (offset_in_block + n) % A1FS_BLOCK_SIZE;
+		memset(*dest - offset_in_block, 0, offset_in_block);
+		if(end_in_block != 0) memset(*dest + n, 0, A1FS_BLOCK_SIZE - end_in_block);
+		mark_written(inode, i, block_index, count, fs);
+	}
+	return n;
+}
+
+/**
+ * copy size bytes from buf into the file represented by inode starting at offset,
+ * one extent at a time
+ * NOTE: the range must lie within the file and all of its blocks must be allocated
+**/
+static void write_file_data(a1fs_inode *inode, const char *buf, size_t size, uint64_t offset, int *hint, fs_ctx *fs){
+	while(size > 0){
+		char *dest;
+		size_t n = write_run(inode, size, offset, &dest, hint, fs);
+		memcpy(dest, buf, n);
+		buf += n;
+		offset += n;
+		size -= n;
+	}
+}
+
+/**
+ * move the data of the file represented by inode out of the inode into a data block, so
+ * that the file can grow past inline_capacity(); see A1FS_INODE_INLINE_DATA
+ * NOTE: the caller must hold the inode lock for writing
+ *
+ * @return  0 on success, -ENOSPC if out of space, -ENOMEM if out of memory
+**/
+static int move_inline_data(a1fs_inode *inode, fs_ctx *fs){
+	char data[A1FS_INODE_SIZE_MAX];
+	uint64_t size = inode->size;
+	memcpy(data, get_inline_data(inode), size);
+	//the same bytes hold the extent slots from now on
+	inode->flags &= ~A1FS_INODE_INLINE_DATA;
+	memset(get_inline_data(inode), 0, inline_capacity(fs));
+	if(size > 0){
+		int error = allocate_range(inode, 0, 1, A1FS_EXTENT_UNWRITTEN, fs);
+		if(error != 0){
+			inode->flags &= ~A1FS_INODE_INLINE_EXTENTS;
+			inode->flags |= A1FS_INODE_INLINE_DATA;
+			memcpy(get_inline_data(inode), data, size);
+			return error;
+		}
+		int hint = 0;
+		write_file_data(inode, data, size, 0, &hint, fs);
+	}
+	return 0;
+}
+
+/**
+ * get the file represented by inode ready for a write of size bytes at offset: allocate
+ * the holes the write lands in; any hole it skips over, including one between the end
+ * of the file and offset, stays a hole; on error the blocks it allocated are given back
+ * NOTE: the caller must hold the inode lock for writing
+ *
+ * @return  0 on success, -EFBIG if the write ends past the largest file size,
+ *          -ENOSPC if out of space, -ENOMEM if out of memory
+**/
+static int allocate_write(a1fs_inode *inode, size_t size, uint64_t offset, fs_ctx *fs){
+	if(offset + size > A1FS_MAX_FILE_SIZE) return -EFBIG;
+	if(is_inline(inode, fs)){
+		if(offset + size <= inline_capacity(fs)) return 0;
+		int error = move_inline_data(inode, fs);
+		if(error != 0) return error;
+	}
+
+	uint64_t first = offset / A1FS_BLOCK_SIZE;
+	uint64_t last = (offset + size - 1) / A1FS_BLOCK_SIZE;
+	return allocate_range(inode, first, last - first + 1, A1FS_EXTENT_UNWRITTEN, fs);
+}
+
+/**
+ * return the extent cursor of the open file h, or a fresh one without a handle
+ * NOTE: reads of the same open file may run at once under the read lock of the inode;
+ * the hints in a handle are only ever guesses, so they are accessed atomically but
+ * without ordering, and a lost update only costs a search
+**/
+static int load_hint(a1fs_handle *h){
+	return (h != NULL) ? __atomic_load_n(&h->extent, __ATOMIC_RELAXED) : 0;
+}
+
+/**
+ * save the extent cursor hint in the open file h, if any
+**/
+static void store_hint(a1fs_handle *h, int hint){
+	if(h != NULL) __atomic_store_n(&h->extent, hint, __ATOMIC_RELAXED);
+}
+
+/**
+ * hint the blocks of the file represented by inode from byte start up to byte end for
+ * reading ahead; holes and unwritten extents read as zeros and are skipped
+ * NOTE: the caller must hold the inode lock
+**/
+static void prefetch_range(a1fs_inode *inode, uint64_t start, uint64_t end, fs_ctx *fs){
+	uint64_t block_index = start / A1FS_BLOCK_SIZE;
+	uint64_t end_block = (end + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+	int i = find_extent(inode, block_index, fs);
+	if(i == -1) i = find_extent_after(inode, block_index, fs);
+	int count = count_extents(inode, fs);
+	while(i < count){
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		if(extent->lblk >= end_block) break;
+		if(!(extent->flags & A1FS_EXTENT_UNWRITTEN)){
+			uint64_t first = (extent->lblk > block_index) ? extent->lblk : block_index;
+			uint64_t last = (uint64_t)extent->lblk + extent->count;
+			if(last > end_block) last = end_block;
+			prefetch_blocks(extent->start + (first - extent->lblk), last - first, fs);
+		}
+		i++;
+	}
+}
+
+/**
+ * note a read of size bytes at offset through the open file h, and when the reads
+ * through h are sequential keep the next A1FS_READAHEAD bytes of the file being read
+ * into memory ahead of them; the window is topped up once the reader is halfway
+ * through it, so that it is refilled in large requests rather than one per read
+ * NOTE: the caller must hold the inode lock; size must not be 0
+**/
+static void track_read(a1fs_inode *inode, uint64_t offset, size_t size, a1fs_handle *h, fs_ctx *fs){
+	if(h == NULL) return;
+	uint64_t next = __atomic_load_n(&h->next_read, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->next_read, offset + size, __ATOMIC_RELAXED);
+	if(offset != next) return;
+
+	uint64_t prefetched = __atomic_load_n(&h->prefetched, __ATOMIC_RELAXED);
+	if(prefetched < offset + size) prefetched = offset + size;
+	if(prefetched - (offset + size) > A1FS_READAHEAD / 2) return;
+	uint64_t end = offset + size + A1FS_READAHEAD;
+	if(end > inode->size) end = inode->size;
+	if(end <= prefetched) return;
+	prefetch_range(inode, prefetched, end, fs);
+	__atomic_store_n(&h->prefetched, end, __ATOMIC_RELAXED);
+}
+
+a1fs_handle *new_handle(a1fs_ino_t ino){
+	a1fs_handle *h = calloc(1, sizeof(*h));
+	if(h != NULL) h->ino = ino;
+	return h;
+}
+
+void free_bufvec(struct fuse_bufvec *bufv){
+	for(size_t i = 0; i < bufv->count; i++){
+		if(!(bufv->buf[i].flags & FUSE_BUF_IS_FD)) free(bufv->buf[i].mem);
+	}
+	free(bufv);
+}
+
+/**
+ * zero the bytes of the file represented by inode from start up to end that are stored
+ * in written blocks; holes and unwritten extents already read as zeros
+**/
+static void zero_file_range(a1fs_inode *inode, uint64_t start, uint64_t end, fs_ctx *fs){
+	while(start < end){
+		uint64_t block_index = start / A1FS_BLOCK_SIZE;
+		int i = find_extent(inode, block_index, fs);
+		if(i == -1){
+			//skip the hole
+			int next = find_extent_after(inode, block_index, fs);
+			if(next == count_extents(inode, fs)) return;
+			start = (uint64_t)get_extent(inode, next, fs)->lblk * A1FS_BLOCK_SIZE;
+			continue;
+		}
+		a1fs_extent *extent = get_extent(inode, i, fs);
+		uint64_t run = mapped_run((uint64_t)extent->lblk + extent->count - block_index, fs);
+		uint64_t run_end = (block_index + run) * A1FS_BLOCK_SIZE;
+		uint64_t n = ((run_end < end) ? run_end : end) - start;
+		if(!(extent->flags & A1FS_EXTENT_UNWRITTEN)){
+			a1fs_blk_t block = extent->start + (block_index - extent->lblk);
+			void *dest = get_block(block, fs);
+			memset(dest + start % A1FS_BLOCK_SIZE, 0, n);
+			put_block(dest, fs);
+			mark_dirty(inode, block, (start % A1FS_BLOCK_SIZE + n + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE, fs);
+		}
+		start += n;
+	}
+}
+
+void stat_inode(a1fs_inode *inode, struct stat *st, fs_ctx *fs){
+	memset(st, 0, sizeof(*st));
+	inode_rdlock(fs, inode->inode_number);
+	st->st_ino = inode->inode_number;
+	st->st_mode = inode->mode;
+	st->st_nlink = inode->links;
+	st->st_size = inode->size;
+	st->st_blocks = count_blocks(inode, fs) * (A1FS_BLOCK_SIZE / 512);
+	st->st_mtim = inode->mtime;
+	inode_unlock(fs, inode->inode_number);
+}
+
+int create_node(a1fs_inode *parent_dir, const char *name, mode_t mode, a1fs_inode **result, fs_ctx *fs){
+	a1fs_ino_t inode_number;
+	if(allocate_inode(&inode_number, parent_dir, S_ISDIR(mode), fs) != 0) return -ENOSPC;
+
+	a1fs_inode *inode = get_inode(inode_number, fs);
+	inode_wrlock(fs, inode_number);
+	inode->inode_number = inode_number;
+	inode->mode = mode;
+	inode->links = S_ISDIR(mode) ? 2 : 1;	// a directory has ".." and "." too
+	inode->size = 0;
+	clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	inode->num_extents = 0;
+	inode->extents = -1;
+	inode->dir_index_blocks = 0;
+	inode->dir_entries = 0;
+	inode->flags = 0;
+	inode->blocks = 0;
+	fs->dir_room[inode_number] = 0;
+	//regular files start out with their data in the inode, if it has room for any
+	if(S_ISREG(mode) && inline_capacity(fs) > 0){
+		inode->flags = A1FS_INODE_INLINE_DATA;
+		memset(get_inline_data(inode), 0, inline_capacity(fs));
+	}
+	inode_unlock(fs, inode_number);
+
+	//note that the only info given to the parent is relative to the inode
+	//hence the process of adding a file is the same as that of a directory
+	inode_wrlock(fs, parent_dir->inode_number);
+	int error = add_dentry(parent_dir, name, inode, fs);
+	inode_unlock(fs, parent_dir->inode_number);
+	if(error != 0){
+		inode_wrlock(fs, inode_number);
+		deallocate_inode(inode, fs);
+		inode_unlock(fs, inode_number);
+		return error;
+	}
+
+	*result = inode;
+	error = sync_changed(inode, fs);
+	return error ? error : sync_changed(parent_dir, fs);
+}
+
+int set_mtime(a1fs_inode *inode, const struct timespec *mtime, fs_ctx *fs){
+	inode_wrlock(fs, inode->inode_number);
+	if(mtime == NULL){
+		clock_gettime(CLOCK_REALTIME, &(inode->mtime));
+	}
+	else{
+		inode->mtime = *mtime;
+	}
+	inode_unlock(fs, inode->inode_number);
+	return sync_changed(inode, fs);
+}
+
+int get_xattr(a1fs_inode *inode, const char *name, char *value, size_t size, fs_ctx *fs){
+	if(strcmp(name, A1FS_XATTR_EXTENTS) != 0) return -ENODATA;
+
+	inode_rdlock(fs, inode->inode_number);
+	char buf[16];
+	int len = snprintf(buf, sizeof(buf), "%u", (unsigned int)count_extents(inode, fs));
+	inode_unlock(fs, inode->inode_number);
+
+	if(size == 0) return len;
+	if(size < (size_t)len) return -ERANGE;
+	memcpy(value, buf, len);
+	return len;
+}
+
+int truncate_file(a1fs_inode *inode, uint64_t size, fs_ctx *fs){
+	if(size > A1FS_MAX_FILE_SIZE) return -EFBIG;
+	inode_wrlock(fs, inode->inode_number);
+	int error = 0;
+	if(is_inline(inode, fs)){
+		if(size <= inline_capacity(fs)){
+			//keep the bytes past the end zero
+			if(size < inode->size) memset(get_inline_data(inode) + size, 0, inode->size - size);
+			goto out;
+		}
+		if((error = move_inline_data(inode, fs)) != 0) goto out;
+	}
+
+	//growing only moves the end of the file; the new range is a hole that reads as zeros
+	if(size < inode->size){
+		uint64_t num_blocks = (size + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		deallocate_range(inode, num_blocks, UINT64_MAX, fs);
+
+		//bytes past the end of the file are kept zero, so that growing the file again
+		//does not bring the old data back
+		uint64_t block_index = size / A1FS_BLOCK_SIZE;
+		int i = find_extent(inode, block_index, fs);
+		if(size % A1FS_BLOCK_SIZE != 0 && i != -1){
+			a1fs_extent *extent = get_extent(inode, i, fs);
+			if(!(extent->flags & A1FS_EXTENT_UNWRITTEN)){
+				a1fs_blk_t block = extent->start + (block_index - extent->lblk);
+				memset(get_block(block, fs) + size % A1FS_BLOCK_SIZE, 0, A1FS_BLOCK_SIZE - size % A1FS_BLOCK_SIZE);
+				mark_dirty(inode, block, 1, fs);
+			}
+		}
+	}
+out:
+	if(error == 0) inode->size = size;
+	inode_unlock(fs, inode->inode_number);
+
+	if(error == 0) error = sync_changed(inode, fs);
+	return error;
+}
+
+int read_file(a1fs_inode *inode, char *buf, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs){
+	inode_rdlock(fs, inode->inode_number);
+	if(offset >= inode->size){
+		inode_unlock(fs, inode->inode_number);
+		return 0;
+	}
+
+	//stop at the end of the file
+	if(size > inode->size - offset) size = inode->size - offset;
+	int hint = load_hint(h);
+	read_file_data(inode, buf, size, offset, &hint, fs);
+	store_hint(h, hint);
+	track_read(inode, offset, size, h, fs);
+
+	inode_unlock(fs, inode->inode_number);
+	return size;
+}
+
+int write_file(a1fs_inode *inode, const char *buf, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs){
+	if(size == 0) return 0;
+	inode_wrlock(fs, inode->inode_number);
+	int error = allocate_write(inode, size, offset, fs);
+	if(error != 0) goto out;
+
+	int hint = load_hint(h);
+	write_file_data(inode, buf, size, offset, &hint, fs);
+	store_hint(h, hint);
+	if(offset + size > inode->size) inode->size = offset + size;
+out:
+	inode_unlock(fs, inode->inode_number);
+	if(error == 0) error = sync_changed(inode, fs);
+	return error ? error : (int)size;
+}
+
+int read_file_buf(a1fs_inode *inode, struct fuse_bufvec **bufp, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs){
+	//the image file may not have the latest data yet, or, with other threads running,
+	//its blocks may be freed and reused before libfuse reads them; copy the data
+	//into a memory buffer under the inode lock
+	if(!fs->dev.direct || fs->multithreaded){
+		struct fuse_bufvec *bufv = malloc(sizeof(*bufv));
+		char *data = malloc(size);
+		if(bufv == NULL || data == NULL){
+			free(bufv);
+			free(data);
+			return -ENOMEM;
+		}
+		*bufv = FUSE_BUFVEC_INIT(read_file(inode, data, size, offset, h, fs));
+		bufv->buf[0].mem = data;
+		*bufp = bufv;
+		return 0;
+	}
+
+	size_t capacity = 4;
+	struct fuse_bufvec *bufv = malloc(sizeof(*bufv) + (capacity - 1) * sizeof(struct fuse_buf));
+	if(bufv == NULL) return -ENOMEM;
+	//an empty buffer at EOF
+	*bufv = FUSE_BUFVEC_INIT(0);
+
+	inode_rdlock(fs, inode->inode_number);
+	//stop at the end of the file
+	if(offset >= inode->size) size = 0;
+	else if(size > inode->size - offset) size = inode->size - offset;
+	if(size > 0){
+		bufv->count = 0;
+		track_read(inode, offset, size, h, fs);
+	}
+
+	int hint = load_hint(h);
+	while(size > 0){
+		if(bufv->count == capacity){
+			capacity *= 2;
+			struct fuse_bufvec *grown = realloc(bufv, sizeof(*bufv) + (capacity - 1) * sizeof(struct fuse_buf));
+			if(grown == NULL) goto nomem;
+			bufv = grown;
+		}
+		char *src;
+		size_t n = read_run(inode, size, offset, &src, &hint, fs);
+		struct fuse_buf *buf = &bufv->buf[bufv->count];
+		*buf = FUSE_BUFVEC_INIT(n).buf[0];
+		if(src == NULL){
+			if((buf->mem = calloc(1, n)) == NULL) goto nomem;
+		}else{
+			buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+			buf->fd = fs->dev.fd;
+			buf->pos = src - (char *)fs->dev.image;
+		}
+		bufv->count++;
+		offset += n;
+		size -= n;
+	}
+	store_hint(h, hint);
+	inode_unlock(fs, inode->inode_number);
+	*bufp = bufv;
+	return 0;
+
+nomem:
+	inode_unlock(fs, inode->inode_number);
+	free_bufvec(bufv);
+	return -ENOMEM;
+}
+
+int write_file_buf(a1fs_inode *inode, struct fuse_bufvec *buf, uint64_t offset, a1fs_handle *h, fs_ctx *fs){
+	size_t size = fuse_buf_size(buf);
+	if(size == 0) return 0;
+	//the image file may have newer data in the block cache; copy into a buffer
+	if(!fs->dev.direct){
+		char *data = malloc(size);
+		if(data == NULL) return -ENOMEM;
+		struct fuse_bufvec mem = FUSE_BUFVEC_INIT(size);
+		mem.buf[0].mem = data;
+		ssize_t copied = fuse_buf_copy(&mem, buf, 0);
+		int ret = (copied < 0) ? (int)copied : write_file(inode, data, copied, offset, h, fs);
+		free(data);
+		return ret;
+	}
+
+	inode_wrlock(fs, inode->inode_number);
+	int error;
+	if((error = allocate_write(inode, size, offset, fs)) != 0) goto out;
+
+	uint64_t pos = offset;
+	size_t left = size;
+	int hint = load_hint(h);
+	while(left > 0){
+		char *dest;
+		size_t n = write_run(inode, left, pos, &dest, &hint, fs);
+		struct fuse_bufvec dst = FUSE_BUFVEC_INIT(n);
+		dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+		dst.buf[0].fd = fs->dev.fd;
+		dst.buf[0].pos = dest - (char *)fs->dev.image;
+		ssize_t copied = fuse_buf_copy(&dst, buf, 0);
+		if(copied != (ssize_t)n){
+			//the blocks are marked written already; don't leave old data in them
+			memset(dest, 0, n);
+			error = (copied < 0) ? copied : -EIO;
+			break;
+		}
+		pos += n;
+		left -= n;
+	}
+	store_hint(h, hint);
+	//a short write covers the extents it got through
+	if(pos > inode->size) inode->size = pos;
+	if(pos > offset) error = 0;
+	size = pos - offset;
+out:
+	inode_unlock(fs, inode->inode_number);
+	if(error == 0) error = sync_changed(inode, fs);
+	return error ? error : (int)size;
+}
+
+int fallocate_file(a1fs_inode *inode, int mode, off_t offset, off_t length, fs_ctx *fs){
+	if(mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) return -EOPNOTSUPP;
+	//a punched hole never changes the size
+	if((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE)) return -EOPNOTSUPP;
+	if(offset < 0 || length <= 0) return -EINVAL;
+	uint64_t end = (uint64_t)offset + length;
+	if(end > A1FS_MAX_FILE_SIZE) return -EFBIG;
+
+	inode_wrlock(fs, inode->inode_number);
+	int error = 0;
+
+	if(is_inline(inode, fs)){
+		//the inode always has room for its data; only a range past it needs blocks
+		if(mode & FALLOC_FL_PUNCH_HOLE){
+			if((uint64_t)offset < inode->size){
+				memset(get_inline_data(inode) + offset, 0, ((end < inode->size) ? end : inode->size) - offset);
+			}
+			goto out;
+		}
+		if(end <= inline_capacity(fs)){
+			if(!(mode & FALLOC_FL_KEEP_SIZE) && end > inode->size) inode->size = end;
+			goto out;
+		}
+		if((error = move_inline_data(inode, fs)) != 0) goto out;
+	}
+
+	if(mode & FALLOC_FL_PUNCH_HOLE){
+		//whole blocks go back to the data bitmap, partial ones are zeroed
+		uint64_t first = (offset + A1FS_BLOCK_SIZE - 1) / A1FS_BLOCK_SIZE;
+		uint64_t last = end / A1FS_BLOCK_SIZE;
+		if(first < last){
+			zero_file_range(inode, offset, first * A1FS_BLOCK_SIZE, fs);
+			deallocate_range(inode, first, last - first, fs);
+			zero_file_range(inode, last * A1FS_BLOCK_SIZE, end, fs);
+		}else{
+			zero_file_range(inode, offset, end, fs);
+		}
+	}else{
+		//the new blocks are unwritten, so nothing has to be zeroed here
+		uint64_t first = offset / A1FS_BLOCK_SIZE;
+		uint64_t last = (end - 1) / A1FS_BLOCK_SIZE;
+		if((error = allocate_range(inode, first, last - first + 1, A1FS_EXTENT_UNWRITTEN, fs)) != 0) goto out;
+		if(!(mode & FALLOC_FL_KEEP_SIZE) && end > inode->size) inode->size = end;
+	}
+out:
+	inode_unlock(fs, inode->inode_number);
+	if(error == 0) error = sync_changed(inode, fs);
+	return error;
+}
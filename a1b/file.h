@@ -0,0 +1,139 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - File operations shared by the FUSE drivers header file.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+//NOTE: the functions below implement the operations of both drivers (a1fs.c,
+// which finds files by path, and a1fs_ll.c, which finds them by inode number)
+// once the inode is known. Reads and writes take the handle of the open file,
+// or NULL if there is none, to find their extents from where the last access
+// through it ended and to read ahead of sequential reads. They take the inode locks themselves, so the inode
+// must not be locked by the caller, and they sync the changed inodes when the
+// file system is mounted with -o sync=always (see sync_changed()).
+
+struct fuse_bufvec;
+
+/** Largest file size; blocks of a file are numbered by a1fs_blk_t lblk. */
+#define A1FS_MAX_FILE_SIZE ((uint64_t)UINT32_MAX * A1FS_BLOCK_SIZE)
+
+/** Name of the read-only attribute reporting the number of extents of a file. */
+#define A1FS_XATTR_EXTENTS "user.a1fs.extents"
+
+/** Number of bytes read ahead of sequential reads through an open file. */
+#define A1FS_READAHEAD (1 << 20)
+
+/** State of an open file, kept in fuse_file_info.fh from open to release. */
+typedef struct a1fs_handle {
+	/** Inode number of the file. */
+	a1fs_ino_t ino;
+	/** Index of the extent the last read or write ended in. */
+	int extent;
+	/** Offset just past the last read; a read starting here is sequential. */
+	uint64_t next_read;
+	/** Offset up to which the file has been read ahead. */
+	uint64_t prefetched;
+
+} a1fs_handle;
+
+/**
+ * make the handle of a new open file with inode number ino
+ * @return  the handle, allocated with malloc(), NULL if out of memory
+**/
+a1fs_handle *new_handle(a1fs_ino_t ino);
+
+/**
+ * create a file or directory (depending on mode) named name in the directory
+ * represented by parent_dir
+ * NOTE: there must be no entry named name in parent_dir already
+ * @param result  set to the inode of the new file on success
+ * @return        0 on success, -ENOSPC if out of inodes or the directory could not grow,
+ *                -ENOMEM if out of memory
+**/
+int create_node(a1fs_inode *parent_dir, const char *name, mode_t mode, a1fs_inode **result, fs_ctx *fs);
+
+/**
+ * fill st with the attributes of the file represented by inode; see a1fs_getattr()
+**/
+void stat_inode(a1fs_inode *inode, struct stat *st, fs_ctx *fs);
+
+/**
+ * set the modification time of the file represented by inode to mtime, or to the
+ * current time if mtime is NULL
+ * @return  0 on success, -errno on failure
+**/
+int set_mtime(a1fs_inode *inode, const struct timespec *mtime, fs_ctx *fs);
+
+/**
+ * get the extended attribute name of the file represented by inode; see a1fs_getxattr()
+ * @return  size of the value on success, -errno on failure
+**/
+int get_xattr(a1fs_inode *inode, const char *name, char *value, size_t size, fs_ctx *fs);
+
+/**
+ * set the size of the file represented by inode; see a1fs_truncate()
+ * @return  0 on success, -errno on failure
+**/
+int truncate_file(a1fs_inode *inode, uint64_t size, fs_ctx *fs);
+
+/**
+ * read up to size bytes at offset of the file represented by inode into buf; see a1fs_read()
+ * @return  number of bytes read, 0 if offset is beyond EOF
+**/
+int read_file(a1fs_inode *inode, char *buf, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs);
+
+/**
+ * write size bytes from buf at offset of the file represented by inode; see a1fs_write()
+ * @return  number of bytes written on success, -errno on failure
+**/
+int write_file(a1fs_inode *inode, const char *buf, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs);
+
+/**
+ * read up to size bytes at offset of the file represented by inode into a buffer vector
+ * passing the written blocks as ranges of the image file (on a single-threaded mount
+ * of an image kept up to date, otherwise copying the data); see a1fs_read_buf()
+ * @param bufp  set to the buffer vector, allocated with malloc(), on success; freed by libfuse
+ * @return      0 on success, -ENOMEM if out of memory
+**/
+int read_file_buf(a1fs_inode *inode, struct fuse_bufvec **bufp, size_t size, uint64_t offset, a1fs_handle *h, fs_ctx *fs);
+
+/**
+ * free a buffer vector made by read_file_buf() and the memory buffers in it
+**/
+void free_bufvec(struct fuse_bufvec *bufv);
+
+/**
+ * write the data in the buffer vector buf at offset of the file represented by inode,
+ * copying it straight to the image file; see a1fs_write_buf()
+ * @return  number of bytes written on success, -errno on failure
+**/
+int write_file_buf(a1fs_inode *inode, struct fuse_bufvec *buf, uint64_t offset, a1fs_handle *h, fs_ctx *fs);
+
+/**
+ * allocate or deallocate space for a range of the file represented by inode; see
+ * a1fs_fallocate()
+ * @return  0 on success, -errno on failure
+**/
+int fallocate_file(a1fs_inode *inode, int mode, off_t offset, off_t length, fs_ctx *fs);
@@ -0,0 +1,159 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Writing changes back to disk implementation.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dirty.h"
+#include "extent.h"
+#include "flush.h"
+
+
+/**
+ * move the data blocks the file represented by inode modified since it was last synced
+ * to data, and add its inode and extent blocks to meta; the inode is no longer changed
+ * NOTE: the caller must hold the inode lock for writing
+**/
+static void take_changes(a1fs_inode *inode, dirty_set *data, dirty_set *meta, fs_ctx *fs){
+	a1fs_blk_t first_data_block = fs->sb->first_data_block;
+	*data = fs->dirty[inode->inode_number];
+	dirty_clear(&fs->dirty[inode->inode_number]);
+	fs->inode_changed[inode->inode_number] = false;
+
+	if(S_ISDIR(inode->mode)){
+		int count = count_extents(inode, fs);
+		for(int i = 0; i < count; i++){
+			a1fs_extent *extent = get_extent(inode, i, fs);
+			dirty_add(data, (uint64_t)first_data_block + extent->start, extent->count);
+			put_extent(inode, extent, fs);
+		}
+		dirty_add(data, (uint64_t)first_data_block + inode->dir_index, inode->dir_index_blocks);
+	}
+	dirty_add(meta, inode_block(inode->inode_number, fs), 1);
+	dirty_extent_map(inode, meta, fs);
+}
+
+/**
+ * write back the bitmap and group descriptor blocks modified since the last sync
+ * the bitmaps are shared, so this writes back other files' allocations too
+**/
+static int sync_bitmaps(fs_ctx *fs){
+	pthread_mutex_lock(&fs->alloc_lock);
+	dirty_set bitmaps = fs->dirty_bitmaps;
+	dirty_clear(&fs->dirty_bitmaps);
+	pthread_mutex_unlock(&fs->alloc_lock);
+	return dirty_sync(&bitmaps, &fs->dev);
+}
+
+int sync_inode(a1fs_inode *inode, fs_ctx *fs){
+	dirty_set data, meta;
+	dirty_clear(&meta);
+	inode_wrlock(fs, inode->inode_number);
+	take_changes(inode, &data, &meta, fs);
+	inode_unlock(fs, inode->inode_number);
+	dirty_add(&meta, 0, 1);
+
+	int error;
+	if((error = dirty_sync(&data, &fs->dev)) != 0) return error;
+	if((error = sync_bitmaps(fs)) != 0) return error;
+	return dirty_sync(&meta, &fs->dev);
+}
+
+int sync_changed(a1fs_inode *inode, fs_ctx *fs){
+	if(fs->sync_mode != A1FS_SYNC_ALWAYS) return 0;
+	return sync_inode(inode, fs);
+}
+
+int sync_all(fs_ctx *fs){
+	dirty_set meta;
+	dirty_clear(&meta);
+	int error = 0;
+
+	for(a1fs_ino_t ino = 0; ino < fs->sb->inodes_count; ino++){
+		dirty_set data;
+		//not inode_wrlock(), which would mark the inode changed
+		pthread_rwlock_wrlock(&fs->inode_locks[ino]);
+		bool changed = fs->inode_changed[ino];
+		if(changed){
+			a1fs_inode *inode = get_inode(ino, fs);
+			take_changes(inode, &data, &meta, fs);
+			put_block(inode, fs);
+		}
+		pthread_rwlock_unlock(&fs->inode_locks[ino]);
+
+		if(changed && error == 0) error = dirty_sync(&data, &fs->dev);
+	}
+	dirty_add(&meta, 0, 1);
+
+	if(error == 0) error = sync_bitmaps(fs);
+	if(error == 0) error = dirty_sync(&meta, &fs->dev);
+	return error;
+}
+
+/**
+ * body of the flusher thread: sync_all() every fs->sync_interval_ms milliseconds until
+ * flusher_stop() is called, and once more before exiting
+**/
+static void *flusher_main(void *arg){
+	fs_ctx *fs = arg;
+	pthread_mutex_lock(&fs->flusher_lock);
+	while(!fs->flusher_stop){
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += fs->sync_interval_ms / 1000;
+		deadline.tv_nsec += (long)(fs->sync_interval_ms % 1000) * 1000000;
+		if(deadline.tv_nsec >= 1000000000){
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while(!fs->flusher_stop &&
+		      pthread_cond_timedwait(&fs->flusher_cond, &fs->flusher_lock, &deadline) != ETIMEDOUT);
+		if(fs->flusher_stop) break;
+
+		pthread_mutex_unlock(&fs->flusher_lock);
+		sync_all(fs);
+		//no file system operation runs on this thread to give back the blocks it used
+		bdev_release(&fs->dev);
+		pthread_mutex_lock(&fs->flusher_lock);
+	}
+	pthread_mutex_unlock(&fs->flusher_lock);
+
+	//write back what changed since the last round
+	sync_all(fs);
+	bdev_release(&fs->dev);
+	return NULL;
+}
+
+bool flusher_start(fs_ctx *fs){
+	if(fs->sync_mode != A1FS_SYNC_PERIODIC) return true;
+	fs->flusher_stop = false;
+	if(pthread_create(&fs->flusher, NULL, flusher_main, fs) != 0) return false;
+	fs->flusher_running = true;
+	return true;
+}
+
+void flusher_stop(fs_ctx *fs){
+	if(!fs->flusher_running) return;
+	pthread_mutex_lock(&fs->flusher_lock);
+	fs->flusher_stop = true;
+	pthread_cond_signal(&fs->flusher_cond);
+	pthread_mutex_unlock(&fs->flusher_lock);
+	pthread_join(fs->flusher, NULL);
+	fs->flusher_running = false;
+}
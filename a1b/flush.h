@@ -0,0 +1,67 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - Writing changes back to disk header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "a1fs.h"
+#include "fs_ctx.h"
+
+
+/**
+ * write the data blocks the file represented by inode modified since it was last synced
+ * back to the image file, then the bitmap blocks modified since the last sync, then its
+ * inode, its extent block and the superblock
+ * the blocks of a directory are not tracked (they are few); all of them are written back
+ *
+ * @param inode  the inode to sync; must not be locked by the caller
+ * @param fs     file system context
+ * @return       0 on success, -errno on failure
+**/
+int sync_inode(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * sync inode if the file system is mounted with -o sync=always; called by operations
+ * that changed inode after they release its lock
+ *
+ * @return  0 on success (or nothing to do), -errno on failure
+**/
+int sync_changed(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * sync every inode changed since it was last synced, batching the metadata blocks of
+ * all of them
+ *
+ * @return  0 on success, -errno on the first failure
+**/
+int sync_all(fs_ctx *fs);
+
+/**
+ * start the thread that runs sync_all() every fs->sync_interval_ms milliseconds, if the
+ * file system is mounted with -o sync=periodic
+ * NOTE: must be called after fuse_main() has daemonized (threads do not survive the fork)
+ *
+ * @return  true on success (or nothing to do), false if the thread could not be created
+**/
+bool flusher_start(fs_ctx *fs);
+
+/**
+ * stop the thread started by flusher_start(), after a last sync_all()
+**/
+void flusher_stop(fs_ctx *fs);
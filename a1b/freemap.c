@@ -0,0 +1,330 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory free space index implementation.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "bitmap.h"
+#include "freemap.h"
+
+
+static int height(const freemap *fm, uint32_t n)
+{
+	return (n == FREEMAP_NONE) ? 0 : fm->nodes[n].height;
+}
+
+static a1fs_blk_t max_count(const freemap *fm, uint32_t n)
+{
+	return (n == FREEMAP_NONE) ? 0 : fm->nodes[n].max_count;
+}
+
+// Recompute the height and max_count of node n from its children
+static void update(freemap *fm, uint32_t n)
+{
+	freemap_node *node = &fm->nodes[n];
+	int hl = height(fm, node->left), hr = height(fm, node->right);
+	node->height = 1 + (hl > hr ? hl : hr);
+
+	node->max_count = node->count;
+	if (max_count(fm, node->left) > node->max_count) node->max_count = max_count(fm, node->left);
+	if (max_count(fm, node->right) > node->max_count) node->max_count = max_count(fm, node->right);
+}
+
+static uint32_t rotate_right(freemap *fm, uint32_t n)
+{
+	uint32_t l = fm->nodes[n].left;
+	fm->nodes[n].left = fm->nodes[l].right;
+	fm->nodes[l].right = n;
+	update(fm, n);
+	update(fm, l);
+	return l;
+}
+
+static uint32_t rotate_left(freemap *fm, uint32_t n)
+{
+	uint32_t r = fm->nodes[n].right;
+	fm->nodes[n].right = fm->nodes[r].left;
+	fm->nodes[r].left = n;
+	update(fm, n);
+	update(fm, r);
+	return r;
+}
+
+// Restore the AVL balance of the subtree rooted at n; returns its new root
+static uint32_t balance(freemap *fm, uint32_t n)
+{
+	update(fm, n);
+	freemap_node *node = &fm->nodes[n];
+	int diff = height(fm, node->left) - height(fm, node->right);
+
+	if (diff > 1) {
+		uint32_t l = node->left;
+		if (height(fm, fm->nodes[l].left) < height(fm, fm->nodes[l].right)) {
+			node->left = rotate_left(fm, l);
+		}
+		return rotate_right(fm, n);
+	}
+	if (diff < -1) {
+		uint32_t r = node->right;
+		if (height(fm, fm->nodes[r].right) < height(fm, fm->nodes[r].left)) {
+			node->right = rotate_right(fm, r);
+		}
+		return rotate_left(fm, n);
+	}
+	return n;
+}
+
+// Insert node x into the subtree rooted at n; returns its new root
+static uint32_t insert(freemap *fm, uint32_t n, uint32_t x)
+{
+	if (n == FREEMAP_NONE) return x;
+	if (fm->nodes[x].start < fm->nodes[n].start) {
+		fm->nodes[n].left = insert(fm, fm->nodes[n].left, x);
+	} else {
+		fm->nodes[n].right = insert(fm, fm->nodes[n].right, x);
+	}
+	return balance(fm, n);
+}
+
+// Detach the leftmost node of the subtree rooted at n into *min; returns its new root
+static uint32_t remove_min(freemap *fm, uint32_t n, uint32_t *min)
+{
+	if (fm->nodes[n].left == FREEMAP_NONE) {
+		*min = n;
+		return fm->nodes[n].right;
+	}
+	fm->nodes[n].left = remove_min(fm, fm->nodes[n].left, min);
+	return balance(fm, n);
+}
+
+// Remove the node starting at block start from the subtree rooted at n
+// (the node is not freed); returns its new root
+static uint32_t remove_node(freemap *fm, uint32_t n, a1fs_blk_t start)
+{
+	freemap_node *node = &fm->nodes[n];
+	if (start < node->start) {
+		node->left = remove_node(fm, node->left, start);
+	} else if (start > node->start) {
+		node->right = remove_node(fm, node->right, start);
+	} else {
+		if (node->right == FREEMAP_NONE) return node->left;
+		uint32_t min;
+		uint32_t right = remove_min(fm, node->right, &min);
+		fm->nodes[min].left = node->left;
+		fm->nodes[min].right = right;
+		n = min;
+	}
+	return balance(fm, n);
+}
+
+// Take a node from the pool, growing it by half when all its nodes are in use
+static uint32_t new_node(freemap *fm)
+{
+	uint32_t x = fm->free_nodes;
+	if (x != FREEMAP_NONE) {
+		fm->free_nodes = fm->nodes[x].left;
+		return x;
+	}
+	if (fm->used == fm->capacity) {
+		// The callers change the bitmap before the index, so they have no way back
+		uint32_t capacity = fm->capacity + fm->capacity / 2 + 16;
+		freemap_node *nodes = realloc(fm->nodes, (size_t)capacity * sizeof(freemap_node));
+		if (nodes == NULL) {
+			perror("a1fs: free space index");
+			abort();
+		}
+		fm->nodes = nodes;
+		fm->capacity = capacity;
+	}
+	return fm->used++;
+}
+
+// Add the free extent [start, start + count) to the tree
+static void add_extent(freemap *fm, a1fs_blk_t start, a1fs_blk_t count)
+{
+	uint32_t x = new_node(fm);
+
+	freemap_node *node = &fm->nodes[x];
+	node->start = start;
+	node->count = count;
+	node->left = FREEMAP_NONE;
+	node->right = FREEMAP_NONE;
+	update(fm, x);
+	fm->root = insert(fm, fm->root, x);
+	fm->num_extents++;
+}
+
+// Remove the free extent node n from the tree and return it to the pool
+static void remove_extent(freemap *fm, uint32_t n)
+{
+	fm->root = remove_node(fm, fm->root, fm->nodes[n].start);
+	fm->nodes[n].left = fm->free_nodes;
+	fm->free_nodes = n;
+	fm->num_extents--;
+}
+
+// Find the last extent starting at or before block; FREEMAP_NONE if none
+static uint32_t find_at_or_before(const freemap *fm, a1fs_blk_t block)
+{
+	uint32_t found = FREEMAP_NONE;
+	for (uint32_t n = fm->root; n != FREEMAP_NONE; ) {
+		if (fm->nodes[n].start <= block) {
+			found = n;
+			n = fm->nodes[n].right;
+		} else {
+			n = fm->nodes[n].left;
+		}
+	}
+	return found;
+}
+
+// Find the first extent starting after block; FREEMAP_NONE if none
+static uint32_t find_after(const freemap *fm, a1fs_blk_t block)
+{
+	uint32_t found = FREEMAP_NONE;
+	for (uint32_t n = fm->root; n != FREEMAP_NONE; ) {
+		if (fm->nodes[n].start > block) {
+			found = n;
+			n = fm->nodes[n].left;
+		} else {
+			n = fm->nodes[n].right;
+		}
+	}
+	return found;
+}
+
+bool freemap_init(freemap *fm, const unsigned char *bitmap, uint32_t num_bits)
+{
+	// Size the pool for the free extents there are now, with some room to fragment
+	uint32_t num_extents = 0;
+	uint32_t pos = 0;
+	while ((pos = bitmap_find_next(bitmap, num_bits, pos, false)) < num_bits) {
+		num_extents++;
+		pos = bitmap_find_next(bitmap, num_bits, pos, true);
+	}
+	fm->capacity = num_extents + num_extents / 8 + 16;
+	fm->nodes = malloc((size_t)fm->capacity * sizeof(freemap_node));
+	if (fm->nodes == NULL) return false;
+	fm->used = 0;
+	fm->free_nodes = FREEMAP_NONE;
+	fm->root = FREEMAP_NONE;
+	fm->num_extents = 0;
+
+	pos = 0;
+	while ((pos = bitmap_find_next(bitmap, num_bits, pos, false)) < num_bits) {
+		uint32_t end = bitmap_find_next(bitmap, num_bits, pos, true);
+		add_extent(fm, pos, end - pos);
+		pos = end;
+	}
+	return true;
+}
+
+void freemap_destroy(freemap *fm)
+{
+	free(fm->nodes);
+}
+
+int freemap_search(const freemap *fm, a1fs_blk_t length, a1fs_extent *extent)
+{
+	if (fm->root == FREEMAP_NONE) return -ENOSPC;
+	// Without a long enough extent, settle for the first of the longest ones
+	if (fm->nodes[fm->root].max_count < length) length = fm->nodes[fm->root].max_count;
+
+	// Descend to the leftmost extent of at least length blocks
+	uint32_t n = fm->root;
+	for (;;) {
+		const freemap_node *node = &fm->nodes[n];
+		if (max_count(fm, node->left) >= length) {
+			n = node->left;
+		} else if (node->count >= length) {
+			break;
+		} else {
+			n = node->right;
+		}
+	}
+	extent->start = fm->nodes[n].start;
+	extent->count = length;
+	return 0;
+}
+
+// Find the first extent starting after goal with at least length blocks in the
+// subtree rooted at n; FREEMAP_NONE if none
+static uint32_t first_fit_after(const freemap *fm, uint32_t n, a1fs_blk_t goal, a1fs_blk_t length)
+{
+	if (n == FREEMAP_NONE || fm->nodes[n].max_count < length) return FREEMAP_NONE;
+	const freemap_node *node = &fm->nodes[n];
+	if (node->start > goal) {
+		uint32_t found = first_fit_after(fm, node->left, goal, length);
+		if (found != FREEMAP_NONE) return found;
+		if (node->count >= length) return n;
+	}
+	return first_fit_after(fm, node->right, goal, length);
+}
+
+int freemap_search_goal(const freemap *fm, a1fs_blk_t goal, a1fs_blk_t length,
+                        a1fs_blk_t room, a1fs_extent *extent)
+{
+	uint32_t n = find_at_or_before(fm, goal);
+	if (n != FREEMAP_NONE && fm->nodes[n].start + fm->nodes[n].count > goal) {
+		a1fs_blk_t available = fm->nodes[n].start + fm->nodes[n].count - goal;
+		extent->start = goal;
+		extent->count = (available < length) ? available : length;
+		return 0;
+	}
+
+	n = first_fit_after(fm, fm->root, goal, length + room);
+	if (n == FREEMAP_NONE) n = first_fit_after(fm, fm->root, goal, length);
+	if (n == FREEMAP_NONE) return freemap_search(fm, length, extent);
+	extent->start = fm->nodes[n].start;
+	extent->count = length;
+	return 0;
+}
+
+void freemap_take(freemap *fm, const a1fs_extent *extent)
+{
+	uint32_t n = find_at_or_before(fm, extent->start);
+	a1fs_blk_t start = fm->nodes[n].start;
+	a1fs_blk_t end = start + fm->nodes[n].count;
+	remove_extent(fm, n);
+
+	// Keep whatever is left on either side of the taken blocks
+	if (start < extent->start) add_extent(fm, start, extent->start - start);
+	if (extent->start + extent->count < end) {
+		add_extent(fm, extent->start + extent->count, end - extent->start - extent->count);
+	}
+}
+
+void freemap_give(freemap *fm, const a1fs_extent *extent)
+{
+	a1fs_blk_t start = extent->start;
+	a1fs_blk_t end = extent->start + extent->count;
+
+	// Merge with the free extents right before and after
+	uint32_t prev = find_at_or_before(fm, start);
+	if (prev != FREEMAP_NONE && fm->nodes[prev].start + fm->nodes[prev].count == start) {
+		start = fm->nodes[prev].start;
+		remove_extent(fm, prev);
+	}
+	uint32_t next = find_after(fm, extent->start);
+	if (next != FREEMAP_NONE && fm->nodes[next].start == end) {
+		end += fm->nodes[next].count;
+		remove_extent(fm, next);
+	}
+	add_extent(fm, start, end - start);
+}
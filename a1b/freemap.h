@@ -0,0 +1,117 @@
+/*
+ * This code is provided solely for the personal and private use of students
+ * taking the CSC369H course at the University of Toronto. Copying for purposes
+ * other than this use is expressly prohibited. All forms of distribution of
+ * this code, including but not limited to public repositories on GitHub,
+ * GitLab, Bitbucket, or any other online platform, whether as given or with
+ * any changes, are expressly prohibited.
+ *
+ * Authors: Alexey Khrabrov, Karen Reid
+ *
+ * All of the files in this directory and all subdirectories are:
+ * Copyright (c) 2020 Karen Reid
+ */
+
+/**
+ * CSC369 Assignment 1 - In-memory free space index header file.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "a1fs.h"
+
+
+/** Index of no node, in place of a child, the root or the head of the free list. */
+#define FREEMAP_NONE UINT32_MAX
+
+/** A free extent; a node of the AVL tree ordered by start block. */
+typedef struct freemap_node {
+	/** First free block. */
+	a1fs_blk_t start;
+	/** Number of free blocks. */
+	a1fs_blk_t count;
+	/** Largest count in the subtree rooted at this node. */
+	a1fs_blk_t max_count;
+	/** Height of the subtree rooted at this node. */
+	int height;
+	/** Children (indices into nodes); FREEMAP_NONE if none. Free nodes chain through left. */
+	uint32_t left;
+	uint32_t right;
+
+} freemap_node;
+
+/**
+ * Index of the free extents of the data bitmap.
+ *
+ * Built from the bitmap at mount time and kept in sync with it by the block
+ * allocator, so that finding free blocks does not scan the bitmap. The free
+ * extents are maximal (neighbours are always merged) and kept in a balanced
+ * tree ordered by start block, where each node also records the longest extent
+ * in its subtree. Not thread safe; protected by fs_ctx alloc_lock.
+ */
+typedef struct freemap {
+	/** Node pool, grown when the free space gets more fragmented. */
+	freemap_node *nodes;
+	/** Number of nodes the pool has room for. */
+	uint32_t capacity;
+	/** Number of nodes handed out so far; the ones past it have never been used. */
+	uint32_t used;
+	/** Root of the tree; FREEMAP_NONE if there is no free space. */
+	uint32_t root;
+	/** Head of the list of nodes given back; FREEMAP_NONE if none. */
+	uint32_t free_nodes;
+	/** Number of free extents in the tree. */
+	uint32_t num_extents;
+
+} freemap;
+
+/**
+ * Initialize the index with the free extents of a bitmap.
+ *
+ * @param fm        pointer to the index to initialize.
+ * @param bitmap    pointer to the start of the bitmap.
+ * @param num_bits  number of bits in the bitmap.
+ * @return          true on success; false if out of memory.
+ */
+bool freemap_init(freemap *fm, const unsigned char *bitmap, uint32_t num_bits);
+
+/** Free all memory held by the index. */
+void freemap_destroy(freemap *fm);
+
+/**
+ * Find free blocks the same way search_bitmap() does: the first free extent of
+ * at least length blocks (trimmed to length), or else the first of the longest.
+ *
+ * @param fm      free space index.
+ * @param length  number of blocks wanted.
+ * @param extent  pointer to the extent that receives the result.
+ * @return        0 on success; -ENOSPC if there are no free blocks.
+ */
+int freemap_search(const freemap *fm, a1fs_blk_t length, a1fs_extent *extent);
+
+/**
+ * Find free blocks for a file whose next block would ideally be goal.
+ *
+ * Returns, in order of preference: the free blocks starting at goal (possibly
+ * fewer than length), the first extent after goal with at least length + room
+ * free blocks, the first extent after goal with at least length free blocks,
+ * or whatever freemap_search() finds.
+ *
+ * @param fm      free space index.
+ * @param goal    preferred first block.
+ * @param length  number of blocks wanted.
+ * @param room    free blocks preferably left after the result for further growth.
+ * @param extent  pointer to the extent that receives the result.
+ * @return        0 on success; -ENOSPC if there are no free blocks.
+ */
+int freemap_search_goal(const freemap *fm, a1fs_blk_t goal, a1fs_blk_t length,
+                        a1fs_blk_t room, a1fs_extent *extent);
+
+/** Remove the blocks of extent, which must all be free, from the index. */
+void freemap_take(freemap *fm, const a1fs_extent *extent);
+
+/** Add the blocks of extent, which must all be used, to the index. */
+void freemap_give(freemap *fm, const a1fs_extent *extent);
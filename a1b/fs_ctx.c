@@ -16,24 +16,258 @@
  * CSC369 Assignment 1 - File system runtime context implementation.
  */
 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "fs_ctx.h"
 #include "a1fs.h"
+#include "extent.h"
 
 
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size)
+bool fs_ctx_init(fs_ctx *fs, const bdev *dev)
 {
-	fs->image = image;
-	fs->size = size;
+	fs->dev = *dev;
 
 	//TODO: check if the file system image can be mounted and initialize its
 	// runtime state
-	fs->sb = (a1fs_superblock *)(fs->image);
-	
+	a1fs_superblock *sb = bdev_get(&fs->dev, 0);
+	if (sb->magic != A1FS_MAGIC) {
+		fprintf(stderr, "Image is not an a1fs file system\n");
+		return false;
+	}
+	if ((sb->features & ~A1FS_FEATURES_SUPPORTED) != 0) {
+		fprintf(stderr, "Image uses unsupported features 0x%x\n",
+		        sb->features & ~A1FS_FEATURES_SUPPORTED);
+		return false;
+	}
+	fs->inode_size = sizeof(a1fs_inode);
+	if (sb->features & A1FS_FEATURE_INLINE_DATA) fs->inode_size = sb->inode_size;
+	bool inode_size_ok = (fs->inode_size >= sizeof(a1fs_inode)) &&
+	                     (fs->inode_size <= A1FS_INODE_SIZE_MAX) &&
+	                     ((fs->inode_size & (fs->inode_size - 1)) == 0);
+	// Group g has inodes g * inodes_per_group onwards, and its descriptor comes
+	// between the superblock and the bitmaps
+	bool groups_ok = !(sb->features & A1FS_FEATURE_BLOCK_GROUPS) ||
+	                 ((sb->groups_count > 0) && (sb->inodes_per_group > 0) &&
+	                  ((uint64_t)sb->groups_count * sb->inodes_per_group == sb->inodes_count) &&
+	                  (sb->group_desc > 0) && (sb->group_desc < sb->data_bitmap));
+	// The superblock, the group descriptors and the bitmaps come before the
+	// (first slice of the) inode table
+	uint64_t meta_blocks = sb->inode_table;
+	bdev_put(&fs->dev, sb);
+	if (meta_blocks == 0 || meta_blocks > fs->dev.size / A1FS_BLOCK_SIZE || !inode_size_ok || !groups_ok) {
+		fprintf(stderr, "Image has an invalid superblock\n");
+		return false;
+	}
+	fs->sb = bdev_map(&fs->dev, 0, meta_blocks);
+	if (fs->sb == NULL) {
+		fprintf(stderr, "Failed to read the image metadata\n");
+		return false;
+	}
+
+	fs->inode_locks = malloc(fs->sb->inodes_count * sizeof(pthread_rwlock_t));
+	if (fs->inode_locks == NULL) return false;
+	for (unsigned int i = 0; i < fs->sb->inodes_count; i++) {
+		pthread_rwlock_init(&fs->inode_locks[i], NULL);
+	}
+	pthread_mutex_init(&fs->alloc_lock, NULL);
+
+	if (!dcache_init(&fs->dcache, A1FS_DCACHE_ENTRIES)) return false;
+
+	unsigned char *data_bitmap = get_bitmap('d', fs);
+	uint32_t num_bits_dmap = fs->sb->blocks_count - fs->sb->resv_blocks_count;
+	if (!freemap_init(&fs->freemap, data_bitmap, num_bits_dmap)) return false;
+
+	// All zeroes is an empty dirty set
+	fs->dirty = calloc(fs->sb->inodes_count, sizeof(dirty_set));
+	if (fs->dirty == NULL) return false;
+	dirty_clear(&fs->dirty_bitmaps);
+	fs->inode_changed = calloc(fs->sb->inodes_count, sizeof(bool));
+	if (fs->inode_changed == NULL) return false;
+	fs->dir_room = calloc(fs->sb->inodes_count, sizeof(uint64_t));
+	if (fs->dir_room == NULL) return false;
+	fs->map_reserved = 0;
+	fs->map_room = calloc(fs->sb->inodes_count, sizeof(uint32_t));
+	if (fs->map_room == NULL) return false;
+
+	// Write back only on fsync() and serve one request at a time until told otherwise
+	fs->multithreaded = false;
+	fs->sync_mode = A1FS_SYNC_NONE;
+	fs->flusher_running = false;
+	fs->flusher_stop = false;
+	pthread_mutex_init(&fs->flusher_lock, NULL);
+	pthread_cond_init(&fs->flusher_cond, NULL);
+
 	return true;
 }
 
 void fs_ctx_destroy(fs_ctx *fs)
 {
 	//TODO: cleanup any resources allocated in fs_ctx_init()
-	(void)fs;
+	for (unsigned int i = 0; i < fs->sb->inodes_count; i++) {
+		pthread_rwlock_destroy(&fs->inode_locks[i]);
+	}
+	free(fs->inode_locks);
+	pthread_mutex_destroy(&fs->alloc_lock);
+	dcache_destroy(&fs->dcache);
+	freemap_destroy(&fs->freemap);
+	free(fs->dirty);
+	free(fs->inode_changed);
+	free(fs->dir_room);
+	free(fs->map_room);
+	pthread_mutex_destroy(&fs->flusher_lock);
+	pthread_cond_destroy(&fs->flusher_cond);
+	bdev_close(&fs->dev);
+}
+
+void inode_rdlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_rdlock(&fs->inode_locks[ino]);
+}
+
+void inode_wrlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_wrlock(&fs->inode_locks[ino]);
+	fs->inode_changed[ino] = true;
+	bdev_writing(&fs->dev);
+}
+
+void inode_unlock(fs_ctx *fs, a1fs_ino_t ino)
+{
+	pthread_rwlock_unlock(&fs->inode_locks[ino]);
+}
+
+
+void *get_block(a1fs_blk_t block_number, fs_ctx *fs){
+	return bdev_get(&fs->dev, (uint64_t)fs->sb->first_data_block + block_number);
+}
+
+a1fs_inode *get_inode(a1fs_ino_t inode_number, fs_ctx *fs){
+	unsigned int inodes_per_block = A1FS_BLOCK_SIZE / fs->inode_size;
+	char *block = bdev_get(&fs->dev, inode_block(inode_number, fs));
+	return (a1fs_inode *)(block + (inode_number % inodes_per_block) * fs->inode_size);
+}
+
+uint64_t inode_block(a1fs_ino_t inode_number, fs_ctx *fs){
+	unsigned int inodes_per_block = A1FS_BLOCK_SIZE / fs->inode_size;
+	if(!has_groups(fs)) return (uint64_t)fs->sb->inode_table + inode_number / inodes_per_block;
+	//slices are whole blocks, so inodes_per_group is a multiple of inodes_per_block
+	a1fs_group_desc *group = get_group(inode_number / fs->sb->inodes_per_group, fs);
+	return (uint64_t)group->inode_table + (inode_number % fs->sb->inodes_per_group) / inodes_per_block;
+}
+
+bool has_groups(fs_ctx *fs){
+	return fs->sb->features & A1FS_FEATURE_BLOCK_GROUPS;
+}
+
+a1fs_group_desc *get_group(uint32_t group, fs_ctx *fs){
+	unsigned int per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_group_desc);
+	a1fs_group_desc *table = bdev_get(&fs->dev, (uint64_t)fs->sb->group_desc + group / per_block);
+	return table + group % per_block;
+}
+
+a1fs_blk_t inode_goal(a1fs_inode *inode, fs_ctx *fs){
+	if(!has_groups(fs)) return 0;
+	return (inode->inode_number / fs->sb->inodes_per_group) * A1FS_BLOCKS_PER_GROUP;
+}
+
+uint64_t inline_capacity(fs_ctx *fs){
+	return fs->inode_size - sizeof(a1fs_inode);
+}
+
+bool is_inline(a1fs_inode *inode, fs_ctx *fs){
+	//without the feature the flags may be left over padding of an older image
+	return inline_capacity(fs) > 0 && (inode->flags & A1FS_INODE_INLINE_DATA);
+}
+
+char *get_inline_data(a1fs_inode *inode){
+	return (char *)(inode + 1);
+}
+
+unsigned char *get_bitmap(unsigned char map, fs_ctx *fs){
+	return bdev_get(&fs->dev, (map == 'd') ? fs->sb->data_bitmap : fs->sb->inode_bitmap);
+}
+
+void put_block(const void *addr, fs_ctx *fs){
+	bdev_put(&fs->dev, addr);
+}
+
+uint64_t mapped_run(uint64_t run, fs_ctx *fs){
+	return fs->dev.contiguous ? run : 1;
+}
+
+void zero_blocks(a1fs_blk_t block, uint64_t count, fs_ctx *fs){
+	while(count > 0){
+		uint64_t n = mapped_run(count, fs);
+		void *start = get_block(block, fs);
+		memset(start, 0, n * A1FS_BLOCK_SIZE);
+		put_block(start, fs);
+		block += n;
+		count -= n;
+	}
+}
+
+void prefetch_blocks(a1fs_blk_t block, uint64_t count, fs_ctx *fs){
+	bdev_prefetch(&fs->dev, (uint64_t)fs->sb->first_data_block + block, count);
+}
+
+a1fs_blk_t get_last_block(a1fs_inode *inode, fs_ctx *fs){
+	a1fs_extent last_extent = *get_extent(inode, count_extents(inode, fs) - 1, fs);
+	a1fs_blk_t last_block = last_extent.start + last_extent.count - 1;
+	return last_block;
+}
+
+void mark_dirty(a1fs_inode *inode, a1fs_blk_t block, a1fs_blk_t count, fs_ctx *fs){
+	dirty_add(&fs->dirty[inode->inode_number], (uint64_t)fs->sb->first_data_block + block, count);
+}
+
+int find_extent(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs){
+	int low = count_extents_before(inode, block_index, fs);
+	if(low == 0) return -1;
+
+	a1fs_extent *extent = get_extent(inode, low - 1, fs);
+	if(block_index >= (uint64_t)extent->lblk + extent->count) return -1;
+	return low - 1;
+}
+
+int find_extent_near(a1fs_inode *inode, uint64_t block_index, int *hint, fs_ctx *fs){
+	int count = count_extents(inode, fs);
+	if(*hint >= 0 && *hint < count){
+		for(int i = *hint; i < count && i <= *hint + 1; i++){
+			a1fs_extent *extent = get_extent(inode, i, fs);
+			if(block_index < extent->lblk) break;
+			if(block_index < (uint64_t)extent->lblk + extent->count){
+				*hint = i;
+				return i;
+			}
+		}
+	}
+	int i = find_extent(inode, block_index, fs);
+	if(i != -1) *hint = i;
+	return i;
+}
+
+int find_extent_after(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs){
+	return count_extents_before(inode, block_index, fs);
+}
+
+int64_t map_file_block(a1fs_inode *inode, uint64_t block_index, uint64_t *run, fs_ctx *fs){
+	int i = find_extent(inode, block_index, fs);
+	if(i == -1) return -1;
+	a1fs_extent *extent = get_extent(inode, i, fs);
+	*run = (uint64_t)extent->lblk + extent->count - block_index;
+	return extent->start + (block_index - extent->lblk);
+}
+
+void *get_byte(a1fs_inode *inode, uint64_t byte_number, fs_ctx *fs){
+	uint64_t run;
+	int64_t block = map_file_block(inode, byte_number / A1FS_BLOCK_SIZE, &run, fs);
+	return get_block(block, fs) + byte_number % A1FS_BLOCK_SIZE;
+}
+
+void *get_front(a1fs_inode *inode, fs_ctx *fs){
+	a1fs_blk_t last_block = get_last_block(inode, fs);
+	void *front = get_block(last_block, fs) + inode->size % A1FS_BLOCK_SIZE;
+	return front;
 }
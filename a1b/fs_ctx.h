@@ -18,37 +18,93 @@
 
 #pragma once
 
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include "options.h"
 
 #include "a1fs.h"
+#include "bdev.h"
+#include "dcache.h"
+#include "dirty.h"
+#include "freemap.h"
 
 
 /**
  * Mounted file system runtime state - "fs context".
  */
 typedef struct fs_ctx {
-	/** Pointer to the start of the image. */
-	void *image;
-	/** Image size in bytes. */
-	size_t size;
+	/** The image, accessed through one of the block device backends. */
+	bdev dev;
 
 	//TODO: useful runtime state of the mounted file system should be cached
 	// here (NOT in global variables in a1fs.c)
 	a1fs_superblock *sb;
+	/** Size of an inode in the inode table in bytes; sizeof(a1fs_inode) unless
+	 * the image has A1FS_FEATURE_INLINE_DATA. */
+	unsigned int inode_size;
+
+	/** Per-inode reader/writer locks, indexed by inode number. */
+	pthread_rwlock_t *inode_locks;
+	/** Protects the bitmaps and the free counts in the superblock and the group
+	 * descriptors. */
+	pthread_mutex_t alloc_lock;
+	/** Cache of (directory, name) -> inode lookups done by path_lookup(). */
+	dcache dcache;
+	/** Free extents of the data bitmap; protected by alloc_lock. */
+	freemap freemap;
+	/** Free blocks set aside by make_extent_room() for extent maps to grow into;
+	 * protected by alloc_lock. */
+	uint64_t map_reserved;
+	/** The part of map_reserved set aside for each inode, indexed by inode number;
+	 * changed with both alloc_lock and the inode lock held. */
+	uint32_t *map_room;
+	/** Data blocks each inode modified since its last fsync, indexed by inode
+	 * number; protected by the inode locks. */
+	dirty_set *dirty;
+	/** Bitmap and group descriptor blocks modified since the last fsync; protected
+	 * by alloc_lock. */
+	dirty_set dirty_bitmaps;
+	/** Whether each inode has been locked for writing (so possibly changed) since
+	 * it was last synced, indexed by inode number; protected by the inode locks. */
+	bool *inode_changed;
+	/** Byte offset of the first block of each compact directory that may have room
+	 * for a new record, indexed by inode number; the blocks before it were found
+	 * full. Protected by the inode locks. */
+	uint64_t *dir_room;
+
+	/** Whether requests are served from multiple threads at once. */
+	bool multithreaded;
+	/** When changes are written back to disk. */
+	a1fs_sync_mode sync_mode;
+	/** Interval of the flusher thread in A1FS_SYNC_PERIODIC mode, in milliseconds. */
+	unsigned int sync_interval_ms;
+	/** Background thread writing changes back in A1FS_SYNC_PERIODIC mode. */
+	pthread_t flusher;
+	/** Whether the flusher thread has been started. */
+	bool flusher_running;
+	/** Tells the flusher thread to exit; protected by flusher_lock. */
+	bool flusher_stop;
+	/** Protects flusher_stop; the flusher waits on flusher_cond between rounds. */
+	pthread_mutex_t flusher_lock;
+	pthread_cond_t flusher_cond;
 
 } fs_ctx;
 
 /**
  * Initialize file system context.
  *
- * @param fs     pointer to the context to initialize.
- * @param image  pointer to the start of the image.
- * @param size   image size in bytes.
- * @return       true on success; false on failure (e.g. invalid superblock).
+ * The superblock, the group descriptors and the bitmaps are kept in memory (see
+ * bdev_map()) while the file system is mounted.
+ *
+ * @param fs   pointer to the context to initialize.
+ * @param dev  the open image; taken over by the context and closed by
+ *             fs_ctx_destroy().
+ * @return     true on success; false on failure (e.g. invalid superblock).
  */
-bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
+bool fs_ctx_init(fs_ctx *fs, const bdev *dev);
 
 /**
  * Destroy file system context.
@@ -56,3 +112,168 @@ bool fs_ctx_init(fs_ctx *fs, void *image, size_t size);
  * Must cleanup all the resources created in fs_ctx_init().
  */
 void fs_ctx_destroy(fs_ctx *fs);
+
+/** Lock inode ino for reading (e.g. reading file data or directory entries). */
+void inode_rdlock(fs_ctx *fs, a1fs_ino_t ino);
+
+/**
+ * Lock inode ino for writing (e.g. changing its size, extents or entries).
+ * The inode is then considered changed until it is next synced.
+ */
+void inode_wrlock(fs_ctx *fs, a1fs_ino_t ino);
+
+/** Release the lock on inode ino taken by inode_rdlock() or inode_wrlock(). */
+void inode_unlock(fs_ctx *fs, a1fs_ino_t ino);
+
+
+//NOTE: the helpers below translate block, inode and file offsets into pointers
+// to the blocks holding them, got from the block device backend. The pointers
+// stay valid until the calling thread starts its next file system operation
+// (see get_fs() in a1fs.c) or gives the block back with put_block(). Blocks
+// used after the thread has locked an inode for writing are written back.
+
+/**
+ * return pointer to the start of data block block_number
+**/
+void *get_block(a1fs_blk_t block_number, fs_ctx *fs);
+
+/**
+ * return pointer to inode inode_number in the inode table
+**/
+a1fs_inode *get_inode(a1fs_ino_t inode_number, fs_ctx *fs);
+
+/**
+ * return the number of the image block holding inode inode_number
+**/
+uint64_t inode_block(a1fs_ino_t inode_number, fs_ctx *fs);
+
+/**
+ * return whether the image is split into block groups (see A1FS_FEATURE_BLOCK_GROUPS)
+**/
+bool has_groups(fs_ctx *fs);
+
+/**
+ * return pointer to the descriptor of block group group; like the bitmaps, the
+ * group descriptor table stays in memory while the file system is mounted
+**/
+a1fs_group_desc *get_group(uint32_t group, fs_ctx *fs);
+
+/**
+ * return the data block near which the data of the file represented by inode should
+ * go: the first block of the group holding the inode, 0 without block groups
+**/
+a1fs_blk_t inode_goal(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * return the number of bytes of file data an inode can hold (see A1FS_INODE_INLINE_DATA),
+ * 0 if the image has no inline data
+**/
+uint64_t inline_capacity(fs_ctx *fs);
+
+/**
+ * return whether the data of the file represented by inode is stored in the inode
+**/
+bool is_inline(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * return pointer to the inline_capacity() bytes of file data stored in inode
+**/
+char *get_inline_data(a1fs_inode *inode);
+
+/**
+ * return pointer to the start of the inode ('i') or data ('d') bitmap
+ * the bitmaps stay in memory while the file system is mounted, so the pointer covers
+ * all of their blocks
+**/
+unsigned char *get_bitmap(unsigned char map, fs_ctx *fs);
+
+/**
+ * give back the block holding addr, got from one of the helpers here, before the
+ * end of the operation; for loops over many blocks, so they don't fill the cache
+**/
+void put_block(const void *addr, fs_ctx *fs);
+
+/**
+ * return how many of run consecutive data blocks can be accessed through the pointer
+ * get_block() returns for the first one: all of them if the backend keeps the image
+ * contiguous in memory, otherwise only that one
+**/
+uint64_t mapped_run(uint64_t run, fs_ctx *fs);
+
+/**
+ * fill count data blocks starting at data block block with zeros
+**/
+void zero_blocks(a1fs_blk_t block, uint64_t count, fs_ctx *fs);
+
+/**
+ * hint that count data blocks starting at data block block will be read soon
+**/
+void prefetch_blocks(a1fs_blk_t block, uint64_t count, fs_ctx *fs);
+
+/**
+ * return the block number of the last data block owned by the file represented by inode
+ * 
+ * @param inode  pointer to inode struct of the file
+ * @param fs     file system context
+**/
+a1fs_blk_t get_last_block(a1fs_inode *inode, fs_ctx *fs);
+
+/**
+ * record that the file represented by inode modified count data blocks starting at
+ * data block block, so that the next fsync of the file writes them back
+ * NOTE: the caller must hold the inode lock for writing
+**/
+void mark_dirty(a1fs_inode *inode, a1fs_blk_t block, a1fs_blk_t count, fs_ctx *fs);
+
+/**
+ * return the number of the extent of inode holding block block_index of the file (see
+ * get_extent()), -1 if the file has no such block
+ * binary searches the extents by lblk, so it takes O(log count_extents())
+**/
+int find_extent(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs);
+
+/**
+ * find_extent() starting from a guess: checks the extent at index *hint and the one
+ * after it before searching, and sets *hint to the index found
+ * for sequential accesses, which stay in the extent of the previous one or move on
+ * to the next, this skips the binary search
+**/
+int find_extent_near(a1fs_inode *inode, uint64_t block_index, int *hint, fs_ctx *fs);
+
+/**
+ * return the number of the first extent of inode starting after block block_index of
+ * the file, count_extents() if there is none
+ * (the extent that follows a hole at block_index)
+**/
+int find_extent_after(a1fs_inode *inode, uint64_t block_index, fs_ctx *fs);
+
+/**
+ * return the data block number holding block block_index of the file represented by inode,
+ * and set run to the number of blocks in the same extent from that block onwards
+ * 
+ * @param inode        pointer to inode struct of the file
+ * @param block_index  index of the block within the file
+ * @param run          set to the number of contiguous blocks starting at the returned block
+ * @param fs           file system context
+ * @return             data block number, -1 if the file has no such block
+**/
+int64_t map_file_block(a1fs_inode *inode, uint64_t block_index, uint64_t *run, fs_ctx *fs);
+
+/**
+ * return pointer to byte byte_number of the file represented by inode
+ * 
+ * @param inode        pointer to inode struct of the file
+ * @param byte_number  offset of the byte within the file, must be within its blocks
+ * @param fs           file system context
+**/
+void *get_byte(a1fs_inode *inode, uint64_t byte_number, fs_ctx *fs);
+
+/**
+ * return pointer to the very front of the file represented by inode.
+ * Front in this case points to the start of the first byte which is not part of the file
+ * but that exists in the last data block owned by this file
+ * 
+ * @param inode  pointer to inode struct to find the front of
+ * @param fs     file system context
+**/
+void *get_front(a1fs_inode *inode, fs_ctx *fs);
@@ -26,44 +26,59 @@
 #include "util.h"
 
 
-void *map_file(const char *path, size_t block_size, size_t *size)
+int open_file(const char *path, size_t block_size, size_t *size)
 {
 	// Open the file for reading and writing
 	int fd = open(path, O_RDWR);
 	if (fd < 0) {
 		perror(path);
-		return NULL;
+		return -1;
 	}
 
-	void *addr = NULL;
 	// Get file size
 	struct stat s;
 	if (fstat(fd, &s) < 0) {
 		perror("fstat");
-		goto end;
+		goto fail;
 	}
 
 	// Check that the file size is valid
 	if (s.st_size == 0) {
 		fprintf(stderr, "Image file is empty\n");
-		goto end;
+		goto fail;
 	}
 	if (s.st_size % block_size != 0) {
 		fprintf(stderr, "Image file size is not a multiple of block size\n");
-		goto end;
+		goto fail;
 	}
+	*size = s.st_size;
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+void *map_file(const char *path, size_t block_size, size_t *size, int flags, int *fd_out)
+{
+	int fd = open_file(path, block_size, size);
+	if (fd < 0) return NULL;
 
 	// Map file contents into memory
-	addr = mmap(NULL, s.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	void *addr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED | flags, fd, 0);
 	if (addr == MAP_FAILED) {
 		perror("mmap");
 		addr = NULL;
 		goto end;
 	}
 	assert(is_aligned((size_t)addr, block_size));
-	*size = s.st_size;
 
 end:
+	// Hand the file descriptor to the caller if it wants one
+	if (addr != NULL && fd_out != NULL) {
+		*fd_out = fd;
+		return addr;
+	}
 	//NOTE: memory mapping keeps a reference to the open file; can safely close
 	// the file descriptor now; a future munmap() will close the file
 	close(fd);
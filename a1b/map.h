@@ -21,6 +21,18 @@
 #include <stddef.h>
 
 
+/**
+ * Open the file for reading and writing.
+ *
+ * File size must be a non-zero multiple of the block_size.
+ *
+ * @param path        image file path.
+ * @param block_size  file system block size.
+ * @param size        pointer to the variable that will be set to file size.
+ * @return            open file descriptor on success; -1 on failure.
+ */
+int open_file(const char *path, size_t block_size, size_t *size);
+
 /**
  * Map the whole file into memory for reading and writing.
  *
@@ -29,7 +41,11 @@
  * @param path        image file path.
  * @param block_size  file system block size.
  * @param size        pointer to the variable that will be set to file size.
+ * @param flags       mmap() flags to add to MAP_SHARED (e.g. MAP_POPULATE).
+ * @param fd          pointer to the variable that will be set to the open file
+ *                    descriptor of the file, which the caller must close; NULL
+ *                    to close it right away.
  * @return            pointer to the file mapping in memory on success;
  *                    NULL on failure.
  */
-void *map_file(const char *path, size_t block_size, size_t *size);
+void *map_file(const char *path, size_t block_size, size_t *size, int flags, int *fd);
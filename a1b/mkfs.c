@@ -20,12 +20,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/mman.h>
 #include <unistd.h>
 #include <time.h>
 
 #include "a1fs.h"
-#include "map.h"
+#include "bdev.h"
+#include "bitmap.h"
 
 
 /** Command line options. */
@@ -34,6 +34,8 @@ typedef struct mkfs_opts {
 	const char *img_path;
 	/** Number of inodes. */
 	size_t n_inodes;
+	/** Inode size in bytes; 0 for sizeof(a1fs_inode). */
+	size_t inode_size;
 
 	/** Print help and exit. */
 	bool help;
@@ -41,6 +43,12 @@ typedef struct mkfs_opts {
 	bool force;
 	/** Zero out image contents. */
 	bool zero;
+	/** Use compact variable length directory entries. */
+	bool compact_dirs;
+	/** Use pread() and pwrite() instead of mapping the image. */
+	bool pread;
+	/** Split the image into block groups. */
+	bool groups;
 
 } mkfs_opts;
 
@@ -55,24 +63,37 @@ Options:\n\
     -h      print help and exit\n\
     -f      force format - overwrite existing a1fs file system\n\
     -z      zero out image contents\n\
+    -c      use compact variable length directory entries\n\
+    -I size inode size in bytes, a power of 2 from %zu to %d; the space\n\
+            past the first %zu bytes holds the data of small files, or the\n\
+            first few extents of larger files and directories\n\
+    -p      use pread() and pwrite() instead of mapping the image into memory,\n\
+            for images larger than the address space\n\
+    -g      split the image into groups of %d blocks, each with its own part\n\
+            of the inode table, so that files are kept near their inodes\n\
 ";
 
 static void print_help(FILE *f, const char *progname)
 {
-	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE);
+	fprintf(f, help_str, progname, A1FS_BLOCK_SIZE, sizeof(a1fs_inode),
+	        A1FS_INODE_SIZE_MAX, sizeof(a1fs_inode), A1FS_BLOCKS_PER_GROUP);
 }
 
 
 static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 {
 	char o;
-	while ((o = getopt(argc, argv, "i:hfvz")) != -1) {
+	while ((o = getopt(argc, argv, "i:I:hfvzcpg")) != -1) {
 		switch (o) {
 			case 'i': opts->n_inodes = strtoul(optarg, NULL, 10); break;
+			case 'I': opts->inode_size = strtoul(optarg, NULL, 10); break;
 
 			case 'h': opts->help  = true; return true;// skip other arguments
 			case 'f': opts->force = true; break;
 			case 'z': opts->zero  = true; break;
+			case 'c': opts->compact_dirs = true; break;
+			case 'p': opts->pread = true; break;
+			case 'g': opts->groups = true; break;
 
 			case '?': return false;
 			default : assert(false);
@@ -89,44 +110,179 @@ static bool parse_args(int argc, char *argv[], mkfs_opts *opts)
 		fprintf(stderr, "Missing or invalid number of inodes\n");
 		return false;
 	}
+	if (opts->inode_size == 0) opts->inode_size = sizeof(a1fs_inode);
+	if ((opts->inode_size < sizeof(a1fs_inode)) || (opts->inode_size > A1FS_INODE_SIZE_MAX) ||
+	    ((opts->inode_size & (opts->inode_size - 1)) != 0)) {
+		fprintf(stderr, "Invalid inode size\n");
+		return false;
+	}
 	return true;
 }
 
 
 /** Determine if the image has already been formatted into a1fs. */
-static bool a1fs_is_present(void *image)
+static bool a1fs_is_present(bdev *dev)
 {
 	//TODO: check if the image already contains a valid a1fs superblock
-	const struct a1fs_superblock *sb = (const struct a1fs_superblock *)(image);
-	if (sb->magic != A1FS_MAGIC){
-		return false;
+	const struct a1fs_superblock *sb = (const struct a1fs_superblock *)bdev_get(dev, 0);
+	bool present = (sb->magic == A1FS_MAGIC);
+	bdev_put(dev, sb);
+	return present;
+}
+
+/** Fill count blocks of the image starting at block with zeros. */
+static void zero_blocks(bdev *dev, uint64_t block, uint64_t count)
+{
+	for (uint64_t b = block; b < block + count; b++) {
+		void *data = bdev_get(dev, b);
+		memset(data, 0, A1FS_BLOCK_SIZE);
+		bdev_put(dev, data);
 	}
-	return true;
 }
 
 unsigned int round_up_divide(unsigned int x, unsigned int y){
 	return x / y + ((x % y) != 0);
 }
+
+/** Set the features chosen by the options in the superblock. */
+static void set_features(a1fs_superblock *sb, mkfs_opts *opts)
+{
+	sb->features = opts->compact_dirs ? A1FS_FEATURE_COMPACT_DIRS : 0;
+	//a larger inode than the struct only makes sense for its inline data
+	if(opts->inode_size > sizeof(a1fs_inode)) sb->features |= A1FS_FEATURE_INLINE_DATA;
+	sb->inode_size = opts->inode_size;
+	//only files that outgrow an extent block get an extent tree
+	sb->features |= A1FS_FEATURE_EXTENT_TREE;
+	if(opts->groups) sb->features |= A1FS_FEATURE_BLOCK_GROUPS;
+	sb->features |= A1FS_FEATURE_BLOCK_COUNT;
+}
+
+/** Create the root directory as inode 0, at the start of the inode table. */
+static void init_root(bdev *dev, a1fs_superblock *sb)
+{
+	unsigned char *inode_bitmap_as_array = bdev_get(dev, sb->inode_bitmap);
+	
+	inode_bitmap_as_array[0] = 1 << 7; // = 1000 0000
+	
+	a1fs_inode *root_inode = bdev_get(dev, sb->inode_table);
+
+	//populate root inode metadata
+	root_inode->mode = S_IFDIR;
+	root_inode->size = 0;
+	root_inode->links = 2;
+	clock_gettime(CLOCK_REALTIME, &(root_inode->mtime));
+	root_inode->inode_number = 0;
+	root_inode->num_extents = 0;
+	root_inode->extents = -1; //initialize to -1 when file is empty
+	root_inode->dir_index_blocks = 0;
+	root_inode->dir_entries = 0;
+	root_inode->flags = 0;
+	root_inode->blocks = 0;
+}
+
+/**
+ * Format the image into a1fs with block groups (see A1FS_FEATURE_BLOCK_GROUPS).
+ *
+ * The superblock is followed by the group descriptor table, a data bitmap block
+ * for each group and the inode bitmap; the groups come after them, each
+ * starting with its slice of the inode table.
+ */
+static bool mkfs_groups(bdev *dev, mkfs_opts *opts)
+{
+	uint64_t blocks_count = dev->size / A1FS_BLOCK_SIZE;
+	uint64_t inodes_per_block = A1FS_BLOCK_SIZE / opts->inode_size;
+	uint64_t descs_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_group_desc);
+
+	// The metadata before the groups grows with the number of groups, so start
+	// with too many and drop groups until the last one has room for its inode
+	// table slice and some data
+	uint64_t groups = blocks_count / A1FS_BLOCKS_PER_GROUP + 1;
+	uint64_t inodes_per_group, itable_blocks, gdt_blocks, imap_blocks, data_blocks;
+	for (;;) {
+		inodes_per_group = (opts->n_inodes + groups - 1) / groups;
+		itable_blocks = (inodes_per_group + inodes_per_block - 1) / inodes_per_block;
+		inodes_per_group = itable_blocks * inodes_per_block;
+		gdt_blocks = (groups + descs_per_block - 1) / descs_per_block;
+		imap_blocks = (inodes_per_group * groups + A1FS_BLOCK_SIZE * 8 - 1) / (A1FS_BLOCK_SIZE * 8);
+		uint64_t meta_blocks = 1 + gdt_blocks + groups + imap_blocks;
+		data_blocks = (blocks_count > meta_blocks) ? blocks_count - meta_blocks : 0;
+		uint64_t full = (groups - 1) * A1FS_BLOCKS_PER_GROUP;
+		if ((data_blocks > full) && (data_blocks - full > itable_blocks)) break;
+		if (groups == 1) return false;
+		groups--;
+	}
+	if (itable_blocks >= A1FS_BLOCKS_PER_GROUP) return false;
+	if (inodes_per_group * groups > UINT32_MAX) return false;
+	// Blocks past the last group are left unused
+	if (data_blocks > groups * A1FS_BLOCKS_PER_GROUP) data_blocks = groups * A1FS_BLOCKS_PER_GROUP;
+
+	a1fs_superblock *sb = bdev_get(dev, 0);
+	sb->magic = A1FS_MAGIC;
+	sb->size = dev->size;
+	sb->group_desc = 1;
+	sb->data_bitmap = sb->group_desc + gdt_blocks;
+	sb->inode_bitmap = sb->data_bitmap + groups;
+	sb->first_data_block = sb->inode_bitmap + imap_blocks;
+	// The root directory is the first inode of the first slice
+	sb->inode_table = sb->first_data_block;
+	sb->groups_count = groups;
+	sb->inodes_per_group = inodes_per_group;
+	sb->inodes_count = inodes_per_group * groups;
+	sb->free_inodes_count = sb->inodes_count - 1;
+	sb->blocks_count = sb->first_data_block + data_blocks;
+	sb->resv_blocks_count = sb->first_data_block;
+	sb->free_blocks_count = data_blocks - groups * itable_blocks;
+	set_features(sb, opts);
+
+	zero_blocks(dev, sb->group_desc, gdt_blocks + groups + imap_blocks);
+	for (uint64_t g = 0; g < groups; g++) {
+		uint64_t first = g * A1FS_BLOCKS_PER_GROUP;
+		uint64_t size = (data_blocks - first < A1FS_BLOCKS_PER_GROUP) ? data_blocks - first
+		                                                                : A1FS_BLOCKS_PER_GROUP;
+		a1fs_group_desc *table = bdev_get(dev, sb->group_desc + g / descs_per_block);
+		a1fs_group_desc *group = &table[g % descs_per_block];
+		group->inode_table = sb->first_data_block + first;
+		group->free_blocks_count = size - itable_blocks;
+		group->free_inodes_count = inodes_per_group - (g == 0);
+		bdev_put(dev, table);
+
+		// The inode table slice is in use, and the bits past a short last group
+		// stand for no blocks
+		unsigned char *bitmap = bdev_get(dev, sb->data_bitmap + g);
+		bitmap_set_range(bitmap, 0, itable_blocks, true);
+		bitmap_set_range(bitmap, size, A1FS_BLOCKS_PER_GROUP - size, true);
+		bdev_put(dev, bitmap);
+	}
+
+	init_root(dev, sb);
+	return true;
+}
 /**
  * Format the image into a1fs.
  *
  * NOTE: Must update mtime of the root directory.
  *
- * @param image  pointer to the start of the image.
- * @param size   image size in bytes.
- * @param opts   command line options.
- * @return       true on success;
- *               false on error, e.g. options are invalid for given image size.
+ * @param dev   the image.
+ * @param opts  command line options.
+ * @return      true on success;
+ *              false on error, e.g. options are invalid for given image size.
  */
-static bool mkfs(void *image, size_t size, mkfs_opts *opts)
+static bool mkfs(bdev *dev, mkfs_opts *opts)
 {
 	//TODO: initialize the superblock and create an empty root directory
 	//NOTE: the mode of the root directory inode should be set to S_IFDIR | 0777
 	
 	
 	unsigned int inodes_count = opts->n_inodes;
+	size_t size = dev->size;
+	//block numbers are 32-bit, so larger images cannot be addressed
+	if(size / A1FS_BLOCK_SIZE > UINT32_MAX){
+		fprintf(stderr, "Image is larger than %llu bytes\n", (unsigned long long)UINT32_MAX * A1FS_BLOCK_SIZE);
+		return false;
+	}
+	if(opts->groups) return mkfs_groups(dev, opts);
 	unsigned int blocks_count = size / A1FS_BLOCK_SIZE;
-	unsigned int inodes_per_block = A1FS_BLOCK_SIZE / sizeof(a1fs_inode);
+	unsigned int inodes_per_block = A1FS_BLOCK_SIZE / opts->inode_size;
 	
 	//find number of blocks for inode table
 	unsigned int num_blocks_itable = round_up_divide(inodes_count, inodes_per_block);
@@ -162,9 +318,9 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	a1fs_ino_t inode_table = inode_bitmap + num_blocks_imap;
 	a1fs_blk_t first_data_block = inode_table + num_blocks_itable;
 
-	a1fs_superblock *sb = (a1fs_superblock *)image;
+	a1fs_superblock *sb = bdev_get(dev, 0);
 
-	//write superblock to image (taken care of by mmap, image acts like pointer into actual file)
+	//write superblock to image (written back when the device is closed)
 	
 	sb->magic = A1FS_MAGIC;
 	sb->size = size;
@@ -177,29 +333,15 @@ static bool mkfs(void *image, size_t size, mkfs_opts *opts)
 	sb->inode_bitmap = inode_bitmap;
 	sb->inode_table = inode_table;
 	sb->first_data_block = first_data_block;
+	set_features(sb, opts);
 
 	//TODO 
 	//initialize root directory !
 
 	//cast data bitmap into array of unsigned char/ array of bytes
-	unsigned char *data_bitmap_as_array = image + sb->data_bitmap * A1FS_BLOCK_SIZE;
-	unsigned char *inode_bitmap_as_array = image + sb->inode_bitmap * A1FS_BLOCK_SIZE;
-	memset(data_bitmap_as_array, 0, num_blocks_dmap * A1FS_BLOCK_SIZE);
-	memset(inode_bitmap_as_array, 0, num_blocks_imap * A1FS_BLOCK_SIZE);
-	
-	inode_bitmap_as_array[0] = 1 << 7; // = 1000 0000
-	
-	a1fs_inode *root_inode = image + sb->inode_table * A1FS_BLOCK_SIZE;
-
-	//populate root inode metadata
-	root_inode->mode = S_IFDIR;
-	root_inode->size = 0;
-	root_inode->links = 2;
-	clock_gettime(CLOCK_REALTIME, &(root_inode->mtime));
-	root_inode->inode_number = 0;
-	root_inode->num_extents = 0;
-	root_inode->extents = -1; //initialize to -1 when file is empty
-	
+	zero_blocks(dev, sb->data_bitmap, num_blocks_dmap);
+	zero_blocks(dev, sb->inode_bitmap, num_blocks_imap);
+	init_root(dev, sb);
 
 	return true;
 }
@@ -219,26 +361,29 @@ int main(int argc, char *argv[])
 		return 0;
 	}
 
-	// Map image file into memory
-	size_t size;
-	void *image = map_file(opts.img_path, A1FS_BLOCK_SIZE, &size);
-	if (image == NULL) return 1;
+	// Open the image; a small cache is enough to write it out in order
+	bdev dev;
+	bool opened = opts.pread ? bdev_open_pread(&dev, opts.img_path, 256)
+	                         : bdev_open_mmap(&dev, opts.img_path, 0);
+	if (!opened) return 1;
+	// Everything mkfs touches is written
+	bdev_writing(&dev);
 
 	// Check if overwriting existing file system
 	int ret = 1;
-	if (!opts.force && a1fs_is_present(image)) {
+	if (!opts.force && a1fs_is_present(&dev)) {
 		fprintf(stderr, "Image already contains a1fs; use -f to overwrite\n");
 		goto end;
 	}
 
-	if (opts.zero) memset(image, 0, size);
-	if (!mkfs(image, size, &opts)) {
+	if (opts.zero) zero_blocks(&dev, 0, dev.size / A1FS_BLOCK_SIZE);
+	if (!mkfs(&dev, &opts)) {
 		fprintf(stderr, "Failed to format the image\n");
 		goto end;
 	}
 
 	ret = 0;
 end:
-	munmap(image, size);
+	bdev_close(&dev);
 	return ret;
 }
@@ -18,7 +18,9 @@
 
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "options.h"
 
@@ -31,6 +33,15 @@
 static const struct fuse_opt opt_spec[] = {
 	A1FS_OPT("-h"    , help),
 	A1FS_OPT("--help", help),
+	A1FS_OPT("multithreaded", multithreaded),
+	A1FS_OPT("lowlevel", lowlevel),
+	{ "sync=%s", offsetof(a1fs_opts, sync), 0 },
+	A1FS_OPT("hugepage", hugepage),
+	A1FS_OPT("populate", populate),
+	A1FS_OPT("prefetch_meta", prefetch_meta),
+	{ "access=%s", offsetof(a1fs_opts, access), 0 },
+	{ "backend=%s", offsetof(a1fs_opts, backend), 0 },
+	{ "cache_mb=%u", offsetof(a1fs_opts, cache_mb), 0 },
 	FUSE_OPT_END
 };
 
@@ -38,12 +49,34 @@ static const char *help_str = "\
 Usage: %s image mountpoint [options]\n\
 \n\
 Mount a1fs image file under mount point directory. Use fusermount(1) to \n\
-unmount. Only single-threaded mount is supported; -s FUSE option is implied.\n\
+unmount. The mount is single-threaded (-s FUSE option is implied) unless\n\
+-o multithreaded is given.\n\
 \n\
 general options:\n\
     -o opt,[opt...]        mount options\n\
     -h   --help            print help\n\
 \n\
+a1fs options:\n\
+    -o multithreaded       serve requests from multiple threads\n\
+    -o lowlevel            use the FUSE low-level API: files are identified\n\
+                           by inode number instead of by path\n\
+    -o sync=MODE           when to write changes to the image back to disk:\n\
+                           none (default) - only on fsync()\n\
+                           always - before each change returns\n\
+                           periodic[:MS] - every MS milliseconds (default %d)\n\
+    -o hugepage            back the image mapping with transparent huge pages\n\
+                           where the kernel supports it for the image file\n\
+    -o populate            fault the whole image in at mount time\n\
+    -o prefetch_meta       read the superblock, bitmaps and inode table in at\n\
+                           mount time\n\
+    -o access=PROFILE      expected access to file data: normal (default),\n\
+                           sequential (aggressive readahead) or random (none)\n\
+    -o backend=NAME        how to access the image:\n\
+                           mmap (default) - map the whole image into memory\n\
+                           pread - read and write blocks through a cache of\n\
+                           cache_mb megabytes, for images larger than memory\n\
+    -o cache_mb=N          block cache size of backend=pread (default %d)\n\
+\n\
 ";
 
 // Callback for fuse_opt_parse()
@@ -60,27 +93,97 @@ static int opt_proc(void *data, const char *arg, int key, struct fuse_args *out)
 }
 
 
+// Parse the value of the sync= option into opts
+static bool parse_sync(const char *value, a1fs_opts *opts)
+{
+	opts->sync_interval_ms = A1FS_SYNC_INTERVAL_MS;
+	if (strcmp(value, "none") == 0) {
+		opts->sync_mode = A1FS_SYNC_NONE;
+	} else if (strcmp(value, "always") == 0) {
+		opts->sync_mode = A1FS_SYNC_ALWAYS;
+	} else if (strncmp(value, "periodic", 8) == 0) {
+		opts->sync_mode = A1FS_SYNC_PERIODIC;
+		if (value[8] == '\0') return true;
+		if (value[8] != ':') return false;
+
+		char *end;
+		unsigned long ms = strtoul(value + 9, &end, 10);
+		if (end == value + 9 || *end != '\0' || ms == 0 || ms > 3600 * 1000) return false;
+		opts->sync_interval_ms = ms;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+// Parse the value of the backend= option into opts
+static bool parse_backend(const char *value, a1fs_opts *opts)
+{
+	if (opts->cache_mb == 0) opts->cache_mb = A1FS_CACHE_MB;
+	if (strcmp(value, "mmap") == 0) {
+		opts->backend_type = A1FS_BACKEND_MMAP;
+	} else if (strcmp(value, "pread") == 0) {
+		opts->backend_type = A1FS_BACKEND_PREAD;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
+// Parse the value of the access= option into opts
+static bool parse_access(const char *value, a1fs_opts *opts)
+{
+	if (strcmp(value, "normal") == 0) {
+		opts->access_advice = MADV_NORMAL;
+	} else if (strcmp(value, "sequential") == 0) {
+		opts->access_advice = MADV_SEQUENTIAL;
+	} else if (strcmp(value, "random") == 0) {
+		opts->access_advice = MADV_RANDOM;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+
 bool a1fs_opt_parse(struct fuse_args *args, a1fs_opts *opts)
 {
 	if (fuse_opt_parse(args, opts, opt_spec, opt_proc) != 0) return false;
 
 	//NOTE: printing to stderr to keep it consistent with FUSE
 	if (opts->help) {
-		fprintf(stderr, help_str, args->argv[0]);
+		fprintf(stderr, help_str, args->argv[0], A1FS_SYNC_INTERVAL_MS, A1FS_CACHE_MB);
 		fuse_opt_add_arg(args, "-ho");
 	}
 	if (!opts->help && !opts->img_path) {
 		fprintf(stderr, "Missing image path\n");
 		return false;
 	}
+	if (!parse_sync(opts->sync ? opts->sync : "none", opts)) {
+		fprintf(stderr, "Invalid sync mode %s\n", opts->sync);
+		return false;
+	}
+	if (!parse_access(opts->access ? opts->access : "normal", opts)) {
+		fprintf(stderr, "Invalid access profile %s\n", opts->access);
+		return false;
+	}
+	if (!parse_backend(opts->backend ? opts->backend : "mmap", opts)) {
+		fprintf(stderr, "Invalid backend %s\n", opts->backend);
+		return false;
+	}
 
-	// Only single-threaded mount is supported
-	fuse_opt_add_arg(args, "-s");
-	// Limit the size of reads and writes to 4K
+	// Single-threaded mount unless requested otherwise
+	if (!opts->multithreaded) fuse_opt_add_arg(args, "-s");
+	// Allow reads and writes of up to 128K (the largest libfuse 2.9 accepts);
+	// a1fs_read() and a1fs_write() handle ranges spanning many blocks
+	fuse_opt_add_arg(args, "-o");
+	fuse_opt_add_arg(args, "big_writes");
 	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_read=4096");
+	fuse_opt_add_arg(args, "max_read=131072");
 	fuse_opt_add_arg(args, "-o");
-	fuse_opt_add_arg(args, "max_write=4096");
+	fuse_opt_add_arg(args, "max_write=131072");
 
 	return true;
 }
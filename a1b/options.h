@@ -23,12 +23,65 @@
 #include <fuse_opt.h>
 
 
+/** When changes to the image are written back to disk (-o sync=). */
+typedef enum a1fs_sync_mode {
+	/** Only on fsync(); otherwise whenever the kernel writes the mapping back (or
+	 * the block cache of -o backend=pread evicts the blocks). */
+	A1FS_SYNC_NONE,
+	/** Before every operation that changes the file system returns. */
+	A1FS_SYNC_ALWAYS,
+	/** By a background thread, every sync_interval_ms milliseconds. */
+	A1FS_SYNC_PERIODIC,
+
+} a1fs_sync_mode;
+
+/** Interval of -o sync=periodic when none is given, in milliseconds. */
+#define A1FS_SYNC_INTERVAL_MS 5000
+
+/** How the image is accessed (-o backend=). See bdev.h. */
+typedef enum a1fs_backend {
+	/** The whole image is mapped into memory. */
+	A1FS_BACKEND_MMAP,
+	/** pread() and pwrite() through a block cache of cache_mb megabytes. */
+	A1FS_BACKEND_PREAD,
+
+} a1fs_backend;
+
+/** Size of the block cache of -o backend=pread when none is given, in megabytes. */
+#define A1FS_CACHE_MB 64
+
 /** a1fs command line options. */
 typedef struct a1fs_opts {
 	/** a1fs image file path. */
 	const char *img_path;
 	/** Print help and exit. FUSE option. */
 	int help;
+	/** Serve requests from multiple threads instead of implying -s. */
+	int multithreaded;
+	/** Use the driver built on the FUSE low-level API (see a1fs_ll.h). */
+	int lowlevel;
+	/** Value of the sync= option; NULL if not given. */
+	char *sync;
+	/** Durability mode parsed from sync. */
+	a1fs_sync_mode sync_mode;
+	/** Flush interval of A1FS_SYNC_PERIODIC, in milliseconds. */
+	unsigned int sync_interval_ms;
+	/** Ask for transparent huge pages for the image mapping. */
+	int hugepage;
+	/** Fault the whole image in at mount time (MAP_POPULATE). */
+	int populate;
+	/** Start reading the metadata (superblock, bitmaps, inode table) in at mount time. */
+	int prefetch_meta;
+	/** Value of the access= option; NULL if not given. */
+	char *access;
+	/** madvise() advice for the data blocks parsed from access. */
+	int access_advice;
+	/** Value of the backend= option; NULL if not given. */
+	char *backend;
+	/** Image access backend parsed from backend. */
+	a1fs_backend backend_type;
+	/** Size of the block cache of A1FS_BACKEND_PREAD, in megabytes. */
+	unsigned int cache_mb;
 
 } a1fs_opts;
 